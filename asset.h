@@ -0,0 +1,25 @@
+/*
+ * asset.h
+ * the layout of packed assets - a 32 bit header with the kind of
+ * compression in the low byte and the unpacked size in the top 24 bits,
+ * then the data, exactly as the BIOS decompression calls expect it
+ */
+
+#ifndef ASSET_H
+#define ASSET_H
+
+/* the kinds of packing, raw data is our own addition */
+#define ASSET_RAW 0x00
+#define ASSET_LZ77 0x10
+#define ASSET_HUFFMAN 0x20
+#define ASSET_RLE 0x30
+
+/* pull apart or build a header */
+#define ASSET_TYPE(header) ((header) & 0xf0)
+#define ASSET_SIZE(header) ((header) >> 8)
+#define ASSET_HEADER(type, size) ((type) | ((size) << 8))
+
+/* huffman headers also give the bits per symbol, 4 or 8, in the low nibble */
+#define ASSET_HUFFMAN_BITS(header) ((header) & 0x0f)
+
+#endif
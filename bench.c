@@ -0,0 +1,596 @@
+/*
+ * bench.c
+ * times the game's hot functions, and a whole frame, on a PC - build it with
+ * -DHOST along with hardware.c, bios.c and reference.c
+ *
+ * usage: collide-bench [-f csv|json] [-b baseline.csv] [-x percent] [-t seconds] [-P recording] [-s]
+ *   -f  how to print the results, csv (the default) or json
+ *   -b  compare against the csv from an earlier run, and fail if anything
+ *       got slower by more than -x percent (20 by default), once the
+ *       machine's own speed is allowed for
+ *   -t  at least how long to spend timing each run, 0.1 seconds by default
+ *   -P  drive the frame benchmark from a binary recording, made by
+ *       collide-host -R, instead of the one built in from bench_replay.h
+ *   -s  drive it from the scripted keys host.c uses instead
+ *
+ * each benchmark is run a power of two times, enough to take the given time,
+ * or as many times as in the baseline, eleven times over taking turns with
+ * the others, and the median is kept - the comparison goes on stderr
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* the game itself is compiled right into this file, then what the drivers share */
+#include "collide.c"
+#include "driver.c"
+
+/* a minute of recorded play for the frame benchmark */
+#include "bench_replay.h"
+
+/* how many timed runs of each benchmark, the one in the middle counts */
+#define BENCH_RUNS 11
+
+/* how many more goes something which looks slower than the baseline gets */
+#define BENCH_RETRIES 2
+
+/* results go here so the compiler can't throw the work away */
+volatile unsigned int bench_sink;
+
+/* the game the benchmarks work on */
+struct Game bench_game;
+
+/* the recording the frame benchmark plays, the built in one unless -P
+ * gives another, or none with -s */
+const unsigned short* bench_runs = replay_runs;
+unsigned int bench_run_count = replay_run_count;
+
+/* a fresh game, with no input being recorded or played */
+void bench_reset() {
+	input_mode = INPUT_LIVE;
+	game_init(&bench_game);
+}
+
+/* looking up tiles which are on the map, the way collision does */
+void bench_tile_lookup(unsigned int n) {
+	unsigned int sum = 0;
+	for (unsigned int i = 0; i < n; i++) {
+		sum += tile_lookup(i & 0xff, (i >> 8) & 0xff, 0, 0, map, map_width, map_height);
+	}
+	bench_sink = sum;
+}
+
+/* and ones far enough off the edge that they wrap round */
+void bench_tile_lookup_wrap(unsigned int n) {
+	unsigned int sum = 0;
+	for (unsigned int i = 0; i < n; i++) {
+		sum += tile_lookup(i & 0xff, (i >> 8) & 0xff, 4096 + i, 2048 + (i >> 4), map, map_width, map_height);
+	}
+	bench_sink = sum;
+}
+
+/* printing a number which changes every time, and sending it in vblank */
+void bench_hud_print_number(unsigned int n) {
+	for (unsigned int i = 0; i < n; i++) {
+		hud_print_number(SCORE_COLUMN + 6, SCORE_ROW, i & 0xffff, SCORE_DIGITS);
+		hud_flush();
+	}
+}
+
+/* a shyguy catching the falco, for each pair the broadphase finds */
+void bench_iskill(unsigned int n) {
+	unsigned int sum = 0;
+	for (unsigned int i = 0; i < n; i++) {
+		sum += iskill(100 << 8, (i & 0xff) << 7, 90 + (i & 15));
+	}
+	bench_sink = sum;
+}
+
+/* taking a sprite and giving it back, the way lasers come and go */
+void bench_sprite_init_free(unsigned int n) {
+	for (unsigned int i = 0; i < n; i++) {
+		struct Sprite* sprite = sprite_init(i & 0xff, 80, SIZE_32_16, 0, 0, 96, 0);
+		sprite_free(sprite);
+	}
+}
+
+void bench_sprite_position(unsigned int n) {
+	struct Sprite* sprite = bench_game.falco.sprite;
+	for (unsigned int i = 0; i < n; i++) {
+		sprite_position(sprite, i & 0xff, (i >> 8) & 0x7f);
+	}
+}
+
+void bench_sprite_move(unsigned int n) {
+	struct Sprite* sprite = bench_game.falco.sprite;
+	for (unsigned int i = 0; i < n; i++) {
+		sprite_move(sprite, (i & 1) ? -1 : 1, (i & 2) ? -1 : 1);
+	}
+}
+
+/* a full set of lasers, put back where they started before they leave */
+void bench_lasers_setup() {
+	sprite_clear();
+	lasers_init(&bench_game.lasers);
+	for (int i = 0; i < MAX_LASERS; i++) {
+		bench_game.lasers.sprite[i] = sprite_init(SCREEN_WIDTH, SCREEN_HEIGHT, SIZE_32_16, 0, 0, 96, 0);
+		bench_game.lasers.count++;
+	}
+}
+
+void bench_lasers_update(unsigned int n) {
+	struct Lasers* lasers = &bench_game.lasers;
+	for (unsigned int i = 0; i < n; i++) {
+		if ((i & 15) == 0) {
+			for (int j = 0; j < lasers->count; j++) {
+				lasers->x[j] = 100 << 8;
+				lasers->y[j] = (j * 8) << 8;
+				lasers->xvel[j] = (j & 1) ? LASER_SPEED : -LASER_SPEED;
+				lasers->life[j] = LASER_LIFETIME;
+			}
+		}
+		lasers_update(lasers);
+	}
+}
+
+/* the falco walking along the level, put back on his feet now and then */
+void bench_falco_update(unsigned int n) {
+	struct Falco* falco = &bench_game.falco;
+	falco->move = 1;
+	for (unsigned int i = 0; i < n; i++) {
+		if ((i & 63) == 0) {
+			falco->y = 113 << 8;
+			falco->yvel = 0;
+		}
+		falco_update(falco, i & 0xff);
+	}
+}
+
+/* working out a whole flow field, from the falco's tile to the edge of
+ * the window */
+void bench_flow_field(unsigned int n) {
+	struct Falco* falco = &bench_game.falco;
+	for (unsigned int i = 0; i < n; i++) {
+		flow_target_row = -1;
+		flow_working = 0;
+		do {
+			flow_update(falco, 0);
+		} while (flow_working);
+	}
+	bench_sink = flow_nodes_visited;
+}
+
+/* every shyguy there can be steering by the field, which costs the same
+ * for each one however many there are */
+void bench_shyguys_setup() {
+	bench_reset();
+	struct Shyguys* shyguys = &bench_game.shyguys;
+	while (shyguy_spawn(shyguys, (shyguys->count * 37) & 0xff) >= 0) {
+	}
+	flow_update(&bench_game.falco, 0);
+	while (flow_working) {
+		flow_update(&bench_game.falco, 0);
+	}
+}
+
+void bench_shyguys_move(unsigned int n) {
+	struct Shyguys* shyguys = &bench_game.shyguys;
+	for (unsigned int i = 0; i < n; i++) {
+		if ((i & 255) == 0) {
+			for (int j = 0; j < shyguys->count; j++) {
+				shyguy_restart(shyguys, j);
+			}
+		}
+		shyguys_move(shyguys, &bench_game.falco, 0);
+	}
+}
+
+/* the most sprites there are room for in OAM, all moving every frame */
+struct Sprite* bench_sprites[NUM_SPRITES];
+
+void bench_sprites_setup() {
+	sprite_clear();
+	for (int i = 0; i < NUM_SPRITES; i++) {
+		bench_sprites[i] = sprite_init((i * 13) & 0xff, (i * 7) % SCREEN_HEIGHT, SIZE_16_16, 0, 0, (i & 3) * 32, i & 3);
+	}
+	dma_flush_all();
+}
+
+void bench_sprite_update_all(unsigned int n) {
+	for (unsigned int i = 0; i < n; i++) {
+		int d = (i & 1) ? -1 : 1;
+		for (int j = 0; j < NUM_SPRITES; j++) {
+			sprite_move(bench_sprites[j], d, 0);
+		}
+		sprite_update_all();
+	}
+}
+
+/* a frame of sound with every voice playing */
+void bench_audio_setup() {
+	audio_init();
+	audio_music(1);
+}
+
+void bench_audio_mix(unsigned int n) {
+	for (unsigned int i = 0; i < n; i++) {
+		if ((i & 7) == 0) {
+			audio_play(SOUND_LASER);
+			audio_play(SOUND_HIT);
+			audio_play(SOUND_DEATH);
+		}
+		audio_vblank();
+		audio_mix();
+	}
+}
+
+/* a game some way in, with lasers flying, for the snapshots to work on */
+unsigned int bench_snapshot[SNAPSHOT_WORDS];
+
+void bench_snapshot_setup() {
+	bench_reset();
+	for (unsigned int i = 0; i < 60; i++) {
+		*buttons = scripted_keys(i);
+		game_tick(&bench_game);
+		wait_vblank();
+		game_vblank(&bench_game);
+	}
+	snapshot_capture(&bench_game, bench_snapshot);
+	rewind_reset(&bench_game);
+}
+
+void bench_snapshot_capture(unsigned int n) {
+	for (unsigned int i = 0; i < n; i++) {
+		bench_sink = snapshot_capture(&bench_game, bench_snapshot);
+	}
+}
+
+/* each restore frees and makes again all the sprites, so sort them now and
+ * then the way a frame would */
+void bench_snapshot_restore(unsigned int n) {
+	for (unsigned int i = 0; i < n; i++) {
+		bench_sink = snapshot_restore(&bench_game, bench_snapshot);
+		if ((i & 15) == 15) {
+			sprite_update_all();
+		}
+	}
+}
+
+/* what changes in a frame: everything moves a little */
+void bench_snapshot_move(unsigned int i) {
+	bench_game.falco.x += 256;
+	bench_game.falco.frame = (i & 1) * 16;
+	for (int j = 0; j < bench_game.shyguys.count; j++) {
+		bench_game.shyguys.x[j] -= 128;
+	}
+	for (int j = 0; j < bench_game.lasers.count; j++) {
+		bench_game.lasers.x[j] += bench_game.lasers.xvel[j];
+	}
+}
+
+void bench_rewind_push(unsigned int n) {
+	for (unsigned int i = 0; i < n; i++) {
+		bench_snapshot_move(i);
+		rewind_push(&bench_game);
+	}
+}
+
+/* a push and the step back which undoes it */
+void bench_rewind_push_step(unsigned int n) {
+	for (unsigned int i = 0; i < n; i++) {
+		bench_snapshot_move(i);
+		rewind_push(&bench_game);
+		bench_sink = rewind_step(&bench_game);
+		if ((i & 15) == 15) {
+			sprite_update_all();
+		}
+	}
+}
+
+/* a fixed sum which has nothing to do with the game: a table driven CRC
+ * of a made up stream of bytes, adds, shifts and loads from a small table
+ * the way the game's code mostly is. only changes to the machine can make
+ * it slower, so how far it moves from the baseline is how far the machine
+ * has, and the other benchmarks are judged with that taken out */
+unsigned int bench_crc_table[256];
+
+void bench_machine_setup() {
+	for (unsigned int i = 0; i < 256; i++) {
+		unsigned int crc = i;
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ ((crc & 1) ? 0xedb88320 : 0);
+		}
+		bench_crc_table[i] = crc;
+	}
+}
+
+void bench_machine(unsigned int n) {
+	unsigned int crc = 0xffffffff;
+	for (unsigned int i = 0; i < n; i++) {
+		unsigned char byte = (i * 2654435761u) >> 24;
+		crc = (crc >> 8) ^ bench_crc_table[(crc ^ byte) & 0xff];
+	}
+	bench_sink = crc;
+}
+
+void bench_frame_setup() {
+	bench_reset();
+	if (bench_runs) {
+		input_replay(bench_runs, bench_run_count);
+	}
+}
+
+/* everything the game does in a frame, starting over when a game ends */
+void bench_frame(unsigned int n) {
+	for (unsigned int i = 0; i < n; i++) {
+		*buttons = scripted_keys(i);
+		game_tick(&bench_game);
+		wait_vblank();
+		game_vblank(&bench_game);
+
+		if (!game_running(&bench_game) || input_replay_done()) {
+			bench_frame_setup();
+		}
+	}
+}
+
+struct Benchmark {
+	const char* name;
+	void (*setup)();
+	void (*run)(unsigned int n);
+};
+
+const struct Benchmark benchmarks[] = {
+	{"tile_lookup", bench_reset, bench_tile_lookup},
+	{"tile_lookup_wrap", bench_reset, bench_tile_lookup_wrap},
+	{"hud_print_number", bench_reset, bench_hud_print_number},
+	{"iskill", bench_reset, bench_iskill},
+	{"sprite_init_free", sprite_clear, bench_sprite_init_free},
+	{"sprite_position", bench_reset, bench_sprite_position},
+	{"sprite_move", bench_reset, bench_sprite_move},
+	{"lasers_update", bench_lasers_setup, bench_lasers_update},
+	{"falco_update", bench_reset, bench_falco_update},
+	{"flow_field", bench_reset, bench_flow_field},
+	{"shyguys_move", bench_shyguys_setup, bench_shyguys_move},
+	{"sprite_update_all", bench_sprites_setup, bench_sprite_update_all},
+	{"audio_mix", bench_audio_setup, bench_audio_mix},
+	{"snapshot_capture", bench_snapshot_setup, bench_snapshot_capture},
+	{"snapshot_restore", bench_snapshot_setup, bench_snapshot_restore},
+	{"rewind_push", bench_snapshot_setup, bench_rewind_push},
+	{"rewind_push_step", bench_snapshot_setup, bench_rewind_push_step},
+	{"frame", bench_frame_setup, bench_frame},
+	{"machine", bench_machine_setup, bench_machine},
+};
+
+#define NUM_BENCHMARKS (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+/* the one which times the machine rather than the game, the last */
+#define BENCH_MACHINE (NUM_BENCHMARKS - 1)
+
+/* seconds of CPU time this process has had, which unlike now() doesn't
+ * count the time it spent waiting for something else to get off the CPU */
+double cpu_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* the time one run of n operations takes */
+double bench_time(const struct Benchmark* bench, unsigned int n) {
+	bench->setup();
+	double start = cpu_now();
+	bench->run(n);
+	return cpu_now() - start;
+}
+
+/* how many operations make a run of a benchmark take the given time - only
+ * doubling means two goes on the same machine almost always settle on the
+ * same count, and so do the same work */
+unsigned int bench_calibrate(const struct Benchmark* bench, double seconds) {
+	unsigned int n = 1;
+	while (bench_time(bench, n) < seconds && n < 0x40000000) {
+		n *= 2;
+	}
+	return n;
+}
+
+/* nanoseconds per operation for each chosen benchmark, the median of a few
+ * runs of each. the runs go round the benchmarks in turn rather than doing
+ * one's all at once, so a second or two of the machine being busy with
+ * something else slows one run of several, which the median throws away,
+ * rather than every run of one */
+void bench_measure(const unsigned char* chosen, const unsigned int* iterations, double* results) {
+	static double times[NUM_BENCHMARKS][BENCH_RUNS];
+	for (int run = 0; run < BENCH_RUNS; run++) {
+		for (unsigned int i = 0; i < NUM_BENCHMARKS; i++) {
+			if (!chosen[i]) {
+				continue;
+			}
+
+			/* keep each benchmark's runs in order from fastest */
+			double elapsed = bench_time(&benchmarks[i], iterations[i]);
+			int j = run;
+			while (j > 0 && times[i][j - 1] > elapsed) {
+				times[i][j] = times[i][j - 1];
+				j--;
+			}
+			times[i][j] = elapsed;
+		}
+	}
+	for (unsigned int i = 0; i < NUM_BENCHMARKS; i++) {
+		if (chosen[i]) {
+			results[i] = times[i][BENCH_RUNS / 2] * 1e9 / iterations[i];
+		}
+	}
+}
+
+/* look a benchmark up in a baseline csv, giving its time and how many
+ * operations it was timed over - returns 0 if it isn't there */
+int baseline_lookup(const char* filename, const char* name, double* ns, unsigned int* iterations) {
+	FILE* file = fopen(filename, "r");
+	if (!file) {
+		perror(filename);
+		exit(1);
+	}
+	char line[256];
+	int found = 0;
+	while (fgets(line, sizeof(line), file)) {
+		char* comma = strchr(line, ',');
+		if (comma) {
+			*comma = '\0';
+			if (strcmp(line, name) == 0) {
+				char* end;
+				*ns = strtod(comma + 1, &end);
+				*iterations = 0;
+				sscanf(end, ",%*f,%u", iterations);
+				found = *ns > 0;
+				break;
+			}
+		}
+	}
+	fclose(file);
+	return found;
+}
+
+/* how much slower one time is than another, in percent */
+double bench_change(double now, double before) {
+	return 100 * (now - before) / before;
+}
+
+int main(int argc, char** argv) {
+	const char* format = "csv";
+	const char* baseline = NULL;
+	double threshold = 20;
+	double seconds = 0.1;
+	const char* play = NULL;
+
+	int option;
+	while ((option = getopt(argc, argv, "f:b:x:t:P:s")) != -1) {
+		switch (option) {
+			case 'f': format = optarg; break;
+			case 'b': baseline = optarg; break;
+			case 'x': threshold = strtod(optarg, NULL); break;
+			case 't': seconds = strtod(optarg, NULL); break;
+			case 'P': play = optarg; break;
+			case 's': bench_runs = NULL; break;
+			default:
+				fprintf(stderr, "usage: %s [-f csv|json] [-b baseline.csv] [-x percent] [-t seconds] [-P recording] [-s]\n", argv[0]);
+				return 1;
+		}
+	}
+	int json = strcmp(format, "json") == 0;
+	if (!json && strcmp(format, "csv") != 0) {
+		fprintf(stderr, "unknown format %s\n", format);
+		return 1;
+	}
+	if (play) {
+		unsigned short* runs;
+		bench_run_count = load_recording(play, &runs);
+		bench_runs = runs;
+	}
+
+	setup_interrupts();
+	profile_init();
+	audio_init();
+
+	/* time each benchmark over as many operations as the baseline did, so
+	 * they do the same work, or enough to take the time asked for */
+	double results[NUM_BENCHMARKS];
+	double before[NUM_BENCHMARKS];
+	unsigned int iterations[NUM_BENCHMARKS];
+	unsigned char chosen[NUM_BENCHMARKS];
+	for (unsigned int i = 0; i < NUM_BENCHMARKS; i++) {
+		before[i] = 0;
+		if (!baseline || !baseline_lookup(baseline, benchmarks[i].name, &before[i], &iterations[i]) ||
+				iterations[i] == 0) {
+			iterations[i] = bench_calibrate(&benchmarks[i], seconds);
+		}
+		chosen[i] = 1;
+	}
+	bench_measure(chosen, iterations, results);
+
+	/* a shared or throttled machine can run everything a good deal slower
+	 * or faster for minutes at a time, so the baseline is scaled by how far
+	 * the machine benchmark moved, which was timed in turns with the rest.
+	 * a baseline from before there was one isn't scaled at all */
+	double drift = before[BENCH_MACHINE] > 0 ? results[BENCH_MACHINE] / before[BENCH_MACHINE] : 1;
+
+	/* anything which looks slower than the baseline is timed again, and the
+	 * quicker go counts - a real slow down is slow every time, a busy
+	 * machine mostly isn't. the number of goes is fixed so it can't keep
+	 * trying until it gets lucky */
+	for (int retry = 0; baseline && retry < BENCH_RETRIES; retry++) {
+		double again[NUM_BENCHMARKS];
+		int any = 0;
+		for (unsigned int i = 0; i < NUM_BENCHMARKS; i++) {
+			chosen[i] = i != BENCH_MACHINE && before[i] > 0 && bench_change(results[i], before[i] * drift) > threshold;
+			any |= chosen[i];
+		}
+		if (!any) {
+			break;
+		}
+		bench_measure(chosen, iterations, again);
+		for (unsigned int i = 0; i < NUM_BENCHMARKS; i++) {
+			if (chosen[i] && again[i] < results[i]) {
+				results[i] = again[i];
+			}
+		}
+	}
+
+	/* ops/sec is frames/sec for the frame benchmark */
+	if (json) {
+		printf("[\n");
+	} else {
+		printf("name,ns_per_op,ops_per_sec,iterations\n");
+	}
+	for (unsigned int i = 0; i < NUM_BENCHMARKS; i++) {
+		if (json) {
+			printf("  {\"name\": \"%s\", \"ns_per_op\": %.3f, \"ops_per_sec\": %.0f, \"iterations\": %u}%s\n",
+					benchmarks[i].name, results[i], 1e9 / results[i], iterations[i],
+					i + 1 < NUM_BENCHMARKS ? "," : "");
+		} else {
+			printf("%s,%.3f,%.0f,%u\n", benchmarks[i].name, results[i], 1e9 / results[i], iterations[i]);
+		}
+	}
+	if (json) {
+		printf("]\n");
+	}
+
+	/* anything slower than the baseline by more than the threshold, with
+	 * the machine allowed for, fails. anything which is only inside it
+	 * because the machine is slower too gets a warning, since the machine
+	 * benchmark could be wrong about that */
+	int slower = 0, warned = 0;
+	if (baseline) {
+		fprintf(stderr, "the machine is %+.1f%% slower than for the baseline, the changes leave that out\n",
+				bench_change(drift, 1));
+		fprintf(stderr, "%-18s %10s %10s %8s %8s\n", "name", "baseline", "now", "change", "raw");
+		for (unsigned int i = 0; i < NUM_BENCHMARKS; i++) {
+			if (before[i] <= 0) {
+				fprintf(stderr, "%-18s %10s %10.3f\n", benchmarks[i].name, "-", results[i]);
+				continue;
+			}
+			if (i == BENCH_MACHINE) {
+				fprintf(stderr, "%-18s %10.3f %10.3f %8s %+7.1f%%\n", benchmarks[i].name,
+						before[i], results[i], "", bench_change(results[i], before[i]));
+				continue;
+			}
+			double change = bench_change(results[i], before[i] * drift);
+			double raw = bench_change(results[i], before[i]);
+			int failed = change > threshold;
+			int warn = !failed && raw > threshold;
+			fprintf(stderr, "%-18s %10.3f %10.3f %+7.1f%% %+7.1f%%%s\n", benchmarks[i].name,
+					before[i], results[i], change, raw, failed ? " slower" : warn ? " WARNING" : "");
+			slower += failed;
+			warned += warn;
+		}
+		if (warned) {
+			fprintf(stderr, "WARNING: %d benchmarks are more than %.0f%% slower than the baseline, and only pass\n"
+					"WARNING: because the machine benchmark says the machine is slower - run it again\n"
+					"WARNING: on a quiet machine before believing that\n", warned, threshold);
+		}
+	}
+	return slower ? 2 : 0;
+}
@@ -0,0 +1,85 @@
+/* recorded by the host build: a minute of walking both ways, jumping,
+ * shooting, standing about and rewinding, which collide-bench plays in
+ * its frame benchmark */
+#define replay_run_count 628
+const unsigned short replay_runs[628] = {
+	0x1410, 0x0012, 0x4810, 0x0412, 0x1010, 0x0012, 0x2010, 0x0411,
+	0x1401, 0x0003, 0x0001, 0x2c00, 0x0002, 0x9000, 0x1c01, 0x1000,
+	0x0001, 0x0003, 0x1801, 0xb600, 0x0011, 0x0012, 0x2c10, 0x0012,
+	0x0410, 0x0c11, 0x0c10, 0x0012, 0x1810, 0x0412, 0x4010, 0x0012,
+	0x0410, 0x3411, 0x1810, 0x0012, 0x4010, 0x0012, 0x3810, 0x0012,
+	0x0811, 0x0c10, 0x0012, 0x5810, 0x0012, 0x0c10, 0x0012, 0x0810,
+	0x8200, 0x3010, 0x0012, 0x2c10, 0x0012, 0x5010, 0x0012, 0x3010,
+	0x0412, 0xa010, 0x0012, 0x1010, 0x1811, 0x0010, 0x0012, 0x4810,
+	0x0012, 0x0410, 0x0012, 0x1410, 0x1811, 0x0012, 0x0c10, 0x0012,
+	0x3810, 0x1c11, 0x0013, 0x0c10, 0x0411, 0x1010, 0x0012, 0x0410,
+	0x0012, 0x2410, 0x0012, 0x0c10, 0x0012, 0x2010, 0x0012, 0x2411,
+	0x2021, 0x0c20, 0x0022, 0x3c20, 0x0022, 0x0020, 0x0022, 0x4420,
+	0x0022, 0x1020, 0x0022, 0x3820, 0x7a00, 0x5810, 0x0012, 0x5c10,
+	0x0012, 0x1410, 0x4420, 0x0022, 0x0420, 0x2021, 0x0023, 0x0420,
+	0x0022, 0x1420, 0x0421, 0x1020, 0x0022, 0x0c20, 0x2c21, 0x0023,
+	0x0421, 0x0023, 0x0021, 0x1020, 0x0022, 0x1c20, 0x0810, 0x0012,
+	0x2410, 0x0012, 0x0010, 0x1011, 0x1c10, 0x0012, 0x1410, 0x1400,
+	0x0002, 0x0800, 0x0022, 0x2420, 0x0c21, 0x0023, 0x0021, 0x4020,
+	0x1000, 0x0002, 0x0000, 0x0002, 0x3000, 0x1420, 0x0022, 0x2c20,
+	0x0022, 0x4020, 0x0022, 0x2420, 0x1c21, 0x1811, 0x0013, 0x0411,
+	0x5810, 0x0012, 0x0410, 0x0012, 0x1c10, 0x0012, 0x1410, 0x0012,
+	0x0810, 0x0413, 0x1c11, 0x0013, 0x0003, 0x0002, 0x1000, 0x0002,
+	0x3800, 0x0002, 0x5800, 0x0002, 0x0c00, 0x0002, 0x1400, 0x7810,
+	0x0020, 0x0022, 0x2820, 0x0022, 0x0c20, 0x0022, 0x8420, 0x3410,
+	0x3c11, 0x0012, 0x1011, 0x0013, 0x2411, 0x3010, 0x0412, 0x0010,
+	0x2c11, 0x3410, 0x0411, 0x0413, 0x1811, 0x1410, 0x0012, 0x5410,
+	0x0411, 0x1010, 0x0811, 0x0013, 0x1810, 0x0012, 0x0410, 0x0012,
+	0x0810, 0x0012, 0x0410, 0x0012, 0x5410, 0x0012, 0x2c10, 0x0012,
+	0x4010, 0x0c20, 0x0022, 0x0c20, 0x0022, 0x1420, 0x2821, 0x3020,
+	0x0021, 0x0023, 0x2821, 0x3820, 0x1021, 0x0023, 0x0421, 0x0020,
+	0x0023, 0x1c21, 0x0023, 0x0421, 0x0022, 0x3420, 0x0421, 0x0020,
+	0x0022, 0x0420, 0x3021, 0x0022, 0x1020, 0x0021, 0x0411, 0x3c10,
+	0x0012, 0x1010, 0x0012, 0x4010, 0x0c11, 0x0013, 0x0c11, 0x1010,
+	0x0011, 0x0013, 0x0011, 0x0410, 0x2811, 0x0013, 0x1011, 0x1810,
+	0x0011, 0x0013, 0x0012, 0x1410, 0x1011, 0x0013, 0x1011, 0x1810,
+	0x0012, 0x0c10, 0x0012, 0x4010, 0x0012, 0x2410, 0x0012, 0x2810,
+	0x0012, 0x0410, 0x0012, 0x1810, 0x0012, 0x0410, 0x2420, 0x1421,
+	0x2c11, 0x0010, 0x0012, 0x0810, 0x0012, 0x0010, 0x0012, 0x3810,
+	0x0012, 0x0810, 0x0c11, 0x4010, 0x0013, 0x1811, 0x7810, 0x0012,
+	0x1c10, 0x0012, 0x6810, 0x0012, 0x0010, 0x0411, 0x0401, 0x0003,
+	0x2801, 0x3000, 0x6200, 0x4c00, 0x0002, 0x3000, 0x0002, 0x2000,
+	0x0002, 0x0000, 0x0401, 0x0003, 0x1801, 0x3000, 0x0002, 0x2c00,
+	0x0811, 0x1810, 0x0412, 0x0810, 0x1c11, 0x0012, 0x3c10, 0x0820,
+	0x0022, 0x0420, 0x0821, 0x0020, 0x0022, 0x5820, 0x0022, 0x1420,
+	0x0022, 0x1420, 0x0022, 0x6c20, 0x0022, 0x0020, 0x0022, 0x1c20,
+	0x0010, 0x0412, 0x3410, 0x0012, 0x2410, 0x0012, 0x0010, 0x0012,
+	0x2010, 0x0012, 0x0810, 0x0012, 0x4010, 0x0012, 0x3410, 0x0411,
+	0x3410, 0x0012, 0x5010, 0x0811, 0x0010, 0x0412, 0x0010, 0x0400,
+	0x3c01, 0x0003, 0x0001, 0x0000, 0x0002, 0x0000, 0x0002, 0x2800,
+	0x2c01, 0x1000, 0x0002, 0x1000, 0x0401, 0x0003, 0x1c01, 0x0400,
+	0x0002, 0x0400, 0x1020, 0x0022, 0x4020, 0x0022, 0x0421, 0x0023,
+	0x3821, 0x3420, 0x0421, 0x0023, 0x2021, 0x0023, 0x0821, 0x0023,
+	0x0021, 0x0820, 0x1021, 0x1020, 0x0002, 0x2400, 0x4c20, 0x0022,
+	0x1420, 0x0421, 0x0023, 0x0c21, 0x3a00, 0x2021, 0x2420, 0x0c21,
+	0x0023, 0x1421, 0x0820, 0x5410, 0x0012, 0x0c10, 0x0012, 0x4010,
+	0x0012, 0x6010, 0x0012, 0x0411, 0x0810, 0x0012, 0x2810, 0x0012,
+	0x3011, 0x0013, 0x2410, 0x0411, 0x0013, 0x1811, 0x3c10, 0x1411,
+	0x0013, 0x0411, 0x0413, 0x0011, 0x0013, 0x1011, 0x1010, 0x0012,
+	0x1c10, 0x0012, 0x1011, 0x0013, 0x2811, 0x1410, 0x0012, 0x4810,
+	0x0012, 0x2010, 0x0012, 0x1010, 0x0012, 0x0010, 0x0012, 0x3010,
+	0x0012, 0x0810, 0x1411, 0x3c10, 0x0012, 0x0810, 0x1011, 0x0801,
+	0x0800, 0x0002, 0x5c00, 0x0401, 0x0003, 0x1801, 0x0003, 0x1401,
+	0x3c00, 0x0002, 0x0000, 0x0402, 0x0000, 0x0801, 0x1000, 0x2810,
+	0x3011, 0x1c10, 0x0012, 0xa410, 0x0012, 0x6810, 0x2011, 0x0810,
+	0x1811, 0x0013, 0x0011, 0x0013, 0x0411, 0x0013, 0x0c11, 0x1010,
+	0x2c11, 0x0012, 0x0810, 0x0012, 0x1410, 0x1820, 0x0022, 0x6420,
+	0x1021, 0x0020, 0x0022, 0x1420, 0x0022, 0x1420, 0x0022, 0x2420,
+	0x0022, 0x3020, 0x6010, 0x3c11, 0x0012, 0x0c10, 0x0012, 0x1810,
+	0x0020, 0x0422, 0x3020, 0x0022, 0x1020, 0x0023, 0x0821, 0x0023,
+	0x0c21, 0x0023, 0x1c21, 0x0023, 0x0022, 0x2020, 0x2c10, 0x0011,
+	0x0013, 0x1411, 0x4c10, 0x0022, 0x0420, 0x0022, 0x0820, 0x4421,
+	0x0420, 0x0022, 0x1c20, 0x0022, 0x0020, 0x1c10, 0x0012, 0x2010,
+	0x0002, 0x2400, 0x0002, 0x0800, 0x0002, 0x0000, 0x0410, 0x4411,
+	0x0010, 0x0012, 0x1410, 0x0012, 0x3c10, 0x0012, 0x3410, 0x0012,
+	0x0410, 0x0013, 0x1411, 0x0413, 0x1011, 0x9410, 0x0012, 0x3410,
+	0x0012, 0x3010, 0x3411, 0x0013, 0x0811, 0x0410, 0x0012, 0x1010,
+	0x1411, 0x0c10, 0x0012, 0x2c10, 0x5c20, 0x0022, 0x1820, 0x1c21,
+	0x0820, 0x2821, 0x2c20, 0x0800, 0x0002, 0x0000, 0x0002, 0x0800,
+	0x0402, 0x0800, 0x0002, 0x0000,
+};
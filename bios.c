@@ -0,0 +1,116 @@
+/*
+ * bios.c
+ * C versions of the GBA BIOS decompression calls, used by the host build
+ * and by the asset packer to check what it made
+ */
+
+#ifdef HOST
+
+#include "hardware.h"
+#include "asset.h"
+
+/* read a little endian word */
+static unsigned int read32(const unsigned char* p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int) p[3] << 24);
+}
+
+void bios_lz77_uncompress_vram(const void* source, volatile void* dest) {
+	const unsigned char* s = (const unsigned char*) source;
+	volatile unsigned char* d = (volatile unsigned char*) dest;
+	unsigned int size = ASSET_SIZE(read32(s));
+	unsigned int out = 0;
+	s += 4;
+
+	while (out < size) {
+		/* each flag byte says whether the next 8 blocks are bytes or copies */
+		unsigned char flags = *s++;
+		for (int bit = 7; bit >= 0 && out < size; bit--) {
+			if (flags & (1 << bit)) {
+				/* copy 3-18 bytes from 1-4096 bytes back */
+				int length = (s[0] >> 4) + 3;
+				int distance = (((s[0] & 0xf) << 8) | s[1]) + 1;
+				s += 2;
+				for (int i = 0; i < length && out < size; i++, out++) {
+					d[out] = d[out - distance];
+				}
+			} else {
+				d[out++] = *s++;
+			}
+		}
+	}
+}
+
+void bios_rle_uncompress_vram(const void* source, volatile void* dest) {
+	const unsigned char* s = (const unsigned char*) source;
+	volatile unsigned char* d = (volatile unsigned char*) dest;
+	unsigned int size = ASSET_SIZE(read32(s));
+	unsigned int out = 0;
+	s += 4;
+
+	while (out < size) {
+		unsigned char flag = *s++;
+		if (flag & 0x80) {
+			/* a run of 3-130 copies of one byte */
+			int length = (flag & 0x7f) + 3;
+			for (int i = 0; i < length && out < size; i++) {
+				d[out++] = *s;
+			}
+			s++;
+		} else {
+			/* 1-128 bytes as they are */
+			int length = flag + 1;
+			for (int i = 0; i < length && out < size; i++) {
+				d[out++] = *s++;
+			}
+		}
+	}
+}
+
+void bios_huffman_uncompress(const void* source, volatile void* dest) {
+	const unsigned char* s = (const unsigned char*) source;
+	volatile unsigned int* d = (volatile unsigned int*) dest;
+	unsigned int header = read32(s);
+	unsigned int size = ASSET_SIZE(header);
+	int bits = ASSET_HUFFMAN_BITS(header);
+
+	/* the tree starts after the header with its size in halfwords, less one,
+	 * and the bit stream follows it */
+	unsigned int root = 5;
+	unsigned int data = 4 + (s[4] + 1) * 2;
+
+	unsigned int node = root;
+	unsigned int word = 0;
+	int filled = 0;
+	unsigned int written = 0;
+
+	while (written < size) {
+		/* bits are read from the top of each word down */
+		unsigned int stream = read32(s + data);
+		data += 4;
+
+		for (int i = 31; i >= 0 && written < size; i--) {
+			int bit = (stream >> i) & 1;
+
+			/* the two children are a pair, found from this node's offset */
+			unsigned char entry = s[node];
+			unsigned int child = (node & ~1u) + (entry & 0x3f) * 2 + 2 + bit;
+
+			if (entry & (bit ? 0x40 : 0x80)) {
+				/* reached a symbol, the first ones fill the low bits */
+				word |= (unsigned int) s[child] << filled;
+				filled += bits;
+				if (filled == 32) {
+					*d++ = word;
+					written += 4;
+					word = 0;
+					filled = 0;
+				}
+				node = root;
+			} else {
+				node = child;
+			}
+		}
+	}
+}
+
+#endif
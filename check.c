@@ -0,0 +1,479 @@
+/*
+ * check.c
+ * checks on a PC what can't be seen by playing: the hand written assembly
+ * against the C in reference.c, the packed assets, and the shyguys finding
+ * their way to the falco - build it with -DHOST along with hardware.c,
+ * bios.c and reference.c
+ *
+ * usage: collide-check [-n inputs] [iskill.s]
+ *   -n  how many random inputs to try, a million by default
+ *
+ * the thumb in iskill.s is read in and run on a model of the handful of
+ * instructions it uses, flags and all, for the awkward inputs and then
+ * for random ones. then each packed asset is unpacked by load_asset, with
+ * bios.c standing in for the BIOS, and compared with the .bin mkassets wrote
+ * beside its header in the current directory. then shyguys are let loose
+ * on a small map of their own
+ * and have to catch a falco who stands still, on the frame and in the
+ * place they did when the check was written. it exits with status 1 and
+ * says what went wrong if anything doesn't match
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+
+/* the game itself is compiled right into this file */
+#include "collide.c"
+
+/* the most instructions a routine can have */
+#define MAX_INSTRUCTIONS 256
+
+/* one instruction: what it is, the registers it names and any number */
+struct Instruction {
+	char op[8];
+	int rd, rn, rm;
+	int immediate;
+	int has_immediate;
+	int line;
+};
+
+struct Instruction program[MAX_INSTRUCTIONS];
+int program_length = 0;
+
+/* the registers and the flags, the way the CPU has them */
+struct Cpu {
+	unsigned int r[16];
+	int n, z, c, v;
+};
+
+/* read a register name, r0 to r15 or lr, returns -1 if it isn't one */
+int parse_register(const char* text) {
+	if (strcmp(text, "lr") == 0) {
+		return 14;
+	}
+	if (text[0] == 'r' && isdigit((unsigned char) text[1])) {
+		int number = atoi(text + 1);
+		return number < 16 ? number : -1;
+	}
+	return -1;
+}
+
+/* read the instructions between a routine's label and its .size, leaving
+ * out comments and directives */
+int load_routine(const char* filename, const char* name) {
+	FILE* file = fopen(filename, "r");
+	if (!file) {
+		perror(filename);
+		exit(1);
+	}
+	char line[256];
+	int inside = 0, number = 0;
+	while (fgets(line, sizeof(line), file)) {
+		number++;
+		char* comment = strchr(line, '@');
+		if (comment) {
+			*comment = '\0';
+		}
+
+		/* the label starts it, a directive naming it ends it */
+		char* text = line + strspn(line, " \t");
+		size_t length = strlen(name);
+		if (strncmp(text, name, length) == 0 && text[length] == ':') {
+			inside = 1;
+			continue;
+		}
+		if (!inside || text[0] == '\0' || text[0] == '\n' || text[0] == '.') {
+			if (inside && strncmp(text, ".size", 5) == 0) {
+				break;
+			}
+			continue;
+		}
+		if (program_length == MAX_INSTRUCTIONS) {
+			fprintf(stderr, "%s: %s is too long\n", filename, name);
+			exit(1);
+		}
+
+		/* the mnemonic, then up to three operands */
+		struct Instruction* instruction = &program[program_length++];
+		memset(instruction, 0, sizeof(*instruction));
+		instruction->rd = instruction->rn = instruction->rm = -1;
+		instruction->line = number;
+		char operands[3][32] = {"", "", ""};
+		int count = sscanf(text, "%7s %31[^, \t\n] , %31[^, \t\n] , %31[^, \t\n]",
+				instruction->op, operands[0], operands[1], operands[2]) - 1;
+		int registers[3], used = 0;
+		for (int i = 0; i < count; i++) {
+			if (operands[i][0] == '#') {
+				instruction->immediate = strtol(operands[i] + 1, NULL, 0);
+				instruction->has_immediate = 1;
+			} else if ((registers[used] = parse_register(operands[i])) >= 0) {
+				used++;
+			} else {
+				fprintf(stderr, "%s:%d: can't read %s\n", filename, number, operands[i]);
+				exit(1);
+			}
+		}
+
+		/* two registers on their own mean the first is also a source */
+		if (used > 0) {
+			instruction->rd = registers[0];
+		}
+		if (used == 2) {
+			instruction->rn = registers[0];
+			instruction->rm = registers[1];
+			if (instruction->has_immediate) {
+				instruction->rn = registers[1];
+			}
+		}
+		if (used == 3) {
+			instruction->rn = registers[1];
+			instruction->rm = registers[2];
+		}
+		if (used == 1) {
+			instruction->rn = registers[0];
+		}
+	}
+	fclose(file);
+	if (program_length == 0) {
+		fprintf(stderr, "%s: no %s in it\n", filename, name);
+		exit(1);
+	}
+	return program_length;
+}
+
+/* the flags an add of a and b plus a carry in sets, returning the sum */
+unsigned int add_flags(struct Cpu* cpu, unsigned int a, unsigned int b, int carry) {
+	unsigned long long wide = (unsigned long long) a + b + carry;
+	unsigned int result = (unsigned int) wide;
+	cpu->c = wide >> 32;
+	cpu->v = (~(a ^ b) & (a ^ result)) >> 31;
+	return result;
+}
+
+/* the flags every logical and move instruction sets */
+unsigned int logic_flags(struct Cpu* cpu, unsigned int result) {
+	cpu->n = result >> 31;
+	cpu->z = result == 0;
+	return result;
+}
+
+/* run the loaded routine until it returns, the thumb way: the low register
+ * forms all set the flags. returns 0 if it ran off the end */
+int run(struct Cpu* cpu) {
+	for (int pc = 0; pc < program_length; pc++) {
+		struct Instruction* i = &program[pc];
+		unsigned int* r = cpu->r;
+		unsigned int a = i->rn >= 0 ? r[i->rn] : 0;
+		unsigned int b = i->has_immediate ? (unsigned int) i->immediate : i->rm >= 0 ? r[i->rm] : 0;
+		int shift = b & 0xff;
+
+		if (strcmp(i->op, "bx") == 0 && i->rd == 14) {
+			return 1;
+		} else if (strcmp(i->op, "mov") == 0) {
+			/* between low registers this is really an add of 0, which
+			 * clears carry and overflow too */
+			r[i->rd] = logic_flags(cpu, i->has_immediate ? b : add_flags(cpu, b, 0, 0));
+		} else if (strcmp(i->op, "add") == 0) {
+			r[i->rd] = logic_flags(cpu, add_flags(cpu, a, b, 0));
+		} else if (strcmp(i->op, "adc") == 0) {
+			r[i->rd] = logic_flags(cpu, add_flags(cpu, a, b, cpu->c));
+		} else if (strcmp(i->op, "sub") == 0) {
+			r[i->rd] = logic_flags(cpu, add_flags(cpu, a, ~b, 1));
+		} else if (strcmp(i->op, "sbc") == 0) {
+			r[i->rd] = logic_flags(cpu, add_flags(cpu, a, ~b, cpu->c));
+		} else if (strcmp(i->op, "cmp") == 0) {
+			logic_flags(cpu, add_flags(cpu, r[i->rd], ~b, 1));
+		} else if (strcmp(i->op, "neg") == 0) {
+			r[i->rd] = logic_flags(cpu, add_flags(cpu, 0, ~r[i->rm >= 0 ? i->rm : i->rd], 1));
+		} else if (strcmp(i->op, "and") == 0) {
+			r[i->rd] = logic_flags(cpu, a & b);
+		} else if (strcmp(i->op, "orr") == 0) {
+			r[i->rd] = logic_flags(cpu, a | b);
+		} else if (strcmp(i->op, "eor") == 0) {
+			r[i->rd] = logic_flags(cpu, a ^ b);
+		} else if (strcmp(i->op, "bic") == 0) {
+			r[i->rd] = logic_flags(cpu, a & ~b);
+		} else if (strcmp(i->op, "mvn") == 0) {
+			r[i->rd] = logic_flags(cpu, ~b);
+		} else if (strcmp(i->op, "lsl") == 0) {
+			/* a shift by nothing leaves carry alone, the last bit shifted
+			 * out goes in it otherwise */
+			if (shift > 0) {
+				cpu->c = shift <= 32 ? (a >> (32 - shift)) & 1 : 0;
+				a = shift < 32 ? a << shift : 0;
+			}
+			r[i->rd] = logic_flags(cpu, a);
+		} else if (strcmp(i->op, "lsr") == 0) {
+			/* an immediate shift of 0 is really 32 */
+			if (i->has_immediate && shift == 0) {
+				shift = 32;
+			}
+			if (shift > 0) {
+				cpu->c = shift <= 32 ? (a >> (shift - 1)) & 1 : 0;
+				a = shift < 32 ? a >> shift : 0;
+			}
+			r[i->rd] = logic_flags(cpu, a);
+		} else if (strcmp(i->op, "asr") == 0) {
+			if (i->has_immediate && shift == 0) {
+				shift = 32;
+			}
+			if (shift > 0) {
+				if (shift >= 32) {
+					a = (int) a < 0 ? 0xffffffff : 0;
+					cpu->c = a & 1;
+				} else {
+					cpu->c = (a >> (shift - 1)) & 1;
+					a = (unsigned int) ((int) a >> shift);
+				}
+			}
+			r[i->rd] = logic_flags(cpu, a);
+		} else {
+			fprintf(stderr, "line %d: no model of %s\n", i->line, i->op);
+			exit(1);
+		}
+	}
+	return 0;
+}
+
+/* a small random number generator, so a failure can be run again */
+unsigned int check_seed = 1;
+
+unsigned int check_random() {
+	check_seed ^= check_seed << 13;
+	check_seed ^= check_seed >> 17;
+	check_seed ^= check_seed << 5;
+	return check_seed;
+}
+
+/* run the assembly on one set of arguments, with rubbish in the other
+ * registers and the flags, and compare it with the C */
+int check_iskill(int falcox, int shyguyx, int falcoy) {
+	struct Cpu cpu;
+	for (int i = 0; i < 16; i++) {
+		cpu.r[i] = check_random();
+	}
+	cpu.n = check_random() & 1;
+	cpu.z = check_random() & 1;
+	cpu.c = check_random() & 1;
+	cpu.v = check_random() & 1;
+	cpu.r[0] = falcox;
+	cpu.r[1] = shyguyx;
+	cpu.r[2] = falcoy;
+
+	if (!run(&cpu)) {
+		fprintf(stderr, "iskill ran off the end without returning\n");
+		exit(1);
+	}
+	int expected = iskill(falcox, shyguyx, falcoy);
+	if ((int) cpu.r[0] != expected) {
+		fprintf(stderr, "iskill(%d, %d, %d) is %d in the assembly but %d in reference.c\n",
+				falcox, shyguyx, falcoy, (int) cpu.r[0], expected);
+		return 0;
+	}
+	return 1;
+}
+
+/* try iskill.s on the awkward inputs and then random ones, returns 0 at
+ * the first which doesn't match */
+int check_assembly(const char* source, unsigned int inputs) {
+	load_routine(source, "iskill");
+
+	/* the edges of each comparison, and where the numbers wrap round */
+	static const int edges[] = {
+		0, 1, -1, 97, 98, 96, 99, (16 << 8) - 1, 16 << 8, (16 << 8) + 1,
+		-(16 << 8) + 1, -(16 << 8), -(16 << 8) - 1, 0x7fffffff, -0x7fffffff - 1,
+		0x7fffffff - (16 << 8), -0x7fffffff + (16 << 8), 0x40000000, -0x40000000,
+	};
+	int count = sizeof(edges) / sizeof(edges[0]);
+	int failed = 0;
+	for (int a = 0; a < count && !failed; a++) {
+		for (int b = 0; b < count && !failed; b++) {
+			for (int c = 0; c < count && !failed; c++) {
+				failed = !check_iskill(edges[a], edges[b], edges[c]);
+			}
+		}
+	}
+
+	/* then random ones, some anywhere and some close enough to matter */
+	for (unsigned int i = 0; i < inputs && !failed; i++) {
+		int falcox = check_random();
+		int shyguyx = (i & 1) ? (int) check_random() : falcox + (int) (check_random() % (64 << 8)) - (32 << 8);
+		int falcoy = (i & 2) ? (int) check_random() : (int) (check_random() % 256) - 64;
+		failed = !check_iskill(falcox, shyguyx, falcoy);
+	}
+	if (failed) {
+		return 0;
+	}
+	printf("iskill matches reference.c for %u inputs\n", count * count * count + inputs);
+	return 1;
+}
+
+/* an asset the game unpacks, and the file mkassets wrote it from */
+struct AssetCheck {
+	const char* filename;
+	const unsigned int* asset;
+};
+
+static const struct AssetCheck asset_checks[] = {
+	{"background.bin", background_packed},
+	{"map2.bin", map2_packed},
+	{"map3.bin", map3_packed},
+	{"map4.bin", map4_packed},
+};
+
+/* unpack an asset the way the game does and compare it with the bytes it
+ * was packed from, returns 0 if they aren't the same */
+int check_asset(const struct AssetCheck* check) {
+	FILE* file = fopen(check->filename, "rb");
+	if (!file) {
+		perror(check->filename);
+		return 0;
+	}
+	fseek(file, 0, SEEK_END);
+	long length = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	/* gbapack pads to a whole number of words */
+	unsigned int size = ASSET_SIZE(check->asset[0]);
+	unsigned char* raw = calloc(size + 4, 1);
+	unsigned char* unpacked = calloc(size + 4, 1);
+	int read = fread(raw, 1, length, file) == (size_t) length;
+	fclose(file);
+
+	int same = 0;
+	if (!read) {
+		perror(check->filename);
+	} else if (size != (((unsigned int) length + 3) & ~3u)) {
+		fprintf(stderr, "%s: the packed asset is %u bytes but the file is %ld\n", check->filename, size, length);
+	} else {
+		load_asset(unpacked, check->asset);
+		same = memcmp(raw, unpacked, size) == 0;
+		if (!same) {
+			fprintf(stderr, "%s: the packed asset doesn't unpack to the same bytes\n", check->filename);
+		}
+	}
+	free(raw);
+	free(unpacked);
+	if (same) {
+		printf("%s: unpacks to the same %ld bytes\n", check->filename, length);
+	}
+	return same;
+}
+
+/* the map the shyguys are checked on, 64 tiles across and 32 down with
+ * only these rows having anything in them: a pit with no bottom, a step
+ * up and a one way platform. # is solid, = one way and ^ a hazard */
+#define CHECK_MAP_WIDTH 64
+#define CHECK_MAP_TOP 13
+
+static const char* const check_rows[] = {
+	"................................................................",
+	"....=====.......................................................",
+	"........................................########################",
+	"........................................########################",
+	"........................................########################",
+	"##############################...###############################",
+	"##############################...###############################",
+};
+
+unsigned int check_bits[CHECK_MAP_WIDTH * 32 / 16];
+struct CollisionMap check_layer = {check_bits, CHECK_MAP_WIDTH, 5};
+
+void check_map() {
+	for (unsigned int row = 0; row < sizeof(check_rows) / sizeof(check_rows[0]); row++) {
+		for (int column = 0; column < CHECK_MAP_WIDTH; column++) {
+			char c = check_rows[row][column];
+			int kind = c == '#' ? TILE_SOLID : c == '=' ? TILE_ONE_WAY : c == '^' ? TILE_HAZARD : TILE_EMPTY;
+			int index = (CHECK_MAP_TOP + row) * CHECK_MAP_WIDTH + column;
+			check_bits[index >> 4] |= kind << ((index & 15) << 1);
+		}
+	}
+}
+
+/* a falco standing still on a tile, a shyguy starting on another, and
+ * where and when it should catch him */
+struct PathCheck {
+	const char* name;
+	int falco_column, falco_row;
+	int shyguy_column, shyguy_row;
+	int frame, x, y;
+};
+
+static const struct PathCheck path_checks[] = {
+	{"down the step and over the pit", 20, 18, 50, 15, 402, 163, 112},
+	{"up onto the platform", 6, 14, 20, 18, 158, 51, 80},
+};
+
+/* the longest a shyguy gets to catch him */
+#define CHECK_FRAMES 1500
+
+/* let a shyguy loose and see when and where it catches the falco, returns
+ * 0 if it doesn't do what it did before */
+int check_path(const struct PathCheck* check) {
+	sprite_clear();
+	static struct Falco falco;
+	static struct Shyguys shyguys;
+	shyguys_init(&shyguys);
+
+	/* the middle of his feet over the column, standing on the row */
+	falco.x = ((check->falco_column << 3) + 4 - FALCO_FEET_X - FALCO_FEET_WIDTH / 2) << 8;
+	falco.y = (((check->falco_row << 3) - 32) << 8) + 1;
+	flow_reset(check->falco_column);
+
+	/* and the shyguy dropped onto its row */
+	int i = shyguy_spawn(&shyguys, (check->shyguy_column << 3) + 4 - 16);
+	shyguys.y[i] = ((check->shyguy_row << 3) - 32) << 8;
+
+	int frame;
+	for (frame = 0; frame < CHECK_FRAMES; frame++) {
+		flow_update(&falco, 0);
+		shyguys_move(&shyguys, &falco, 0);
+		if (isdead(&shyguys, i, &falco, 0)) {
+			break;
+		}
+	}
+	int x = shyguys.x[i] >> 8, y = shyguys.y[i] >> 8;
+	if (frame != check->frame || x != check->x || y != check->y) {
+		if (frame == CHECK_FRAMES) {
+			fprintf(stderr, "%s: didn't catch him, it ended up at %d, %d\n", check->name, x, y);
+		} else {
+			fprintf(stderr, "%s: caught him on frame %d at %d, %d but it was frame %d at %d, %d\n",
+					check->name, frame, x, y, check->frame, check->x, check->y);
+		}
+		return 0;
+	}
+	printf("%s: caught him on frame %d\n", check->name, frame);
+	return 1;
+}
+
+int main(int argc, char** argv) {
+	unsigned int inputs = 1000000;
+
+	int option;
+	while ((option = getopt(argc, argv, "n:")) != -1) {
+		switch (option) {
+			case 'n': inputs = strtoul(optarg, NULL, 0); break;
+			default:
+				fprintf(stderr, "usage: %s [-n inputs] [iskill.s]\n", argv[0]);
+				return 1;
+		}
+	}
+	const char* source = optind < argc ? argv[optind] : "iskill.s";
+	int passed = check_assembly(source, inputs);
+
+	for (unsigned int i = 0; i < sizeof(asset_checks) / sizeof(asset_checks[0]); i++) {
+		passed &= check_asset(&asset_checks[i]);
+	}
+
+	/* the shyguys find their way over the check map instead of the level */
+	setup_interrupts();
+	check_map();
+	flow_layer = &check_layer;
+	for (unsigned int i = 0; i < sizeof(path_checks) / sizeof(path_checks[0]); i++) {
+		passed &= check_path(&path_checks[i]);
+	}
+	return passed ? 0 : 1;
+}
@@ -6,6 +6,12 @@
 #define SCREEN_WIDTH 240
 #define SCREEN_HEIGHT 160
 
+/* the addresses of the hardware, real or simulated */
+#include "hardware.h"
+
+/* the format of packed assets */
+#include "asset.h"
+
 /* include the background image we are using */
 #include "background.h"
 
@@ -22,11 +28,19 @@
 #include "map3.h"
 #include "map4.h"
 
+/* and the background's tiles and the maps that go straight into VRAM, as
+ * packed by tools/gbapack */
+#include "background_packed.h"
+#include "map2_packed.h"
+#include "map3_packed.h"
+#include "map4_packed.h"
+
 /* the tile mode flags needed for display control register */
 #define MODE0 0x00
 #define BG0_ENABLE 0x100
 #define BG1_ENABLE 0x200
 #define BG2_ENABLE 0X400
+#define BG3_ENABLE 0x800
 
 /* flags to set sprite handling in display control register */
 #define SPRITE_MAP_2D 0x0
@@ -35,9 +49,10 @@
 
 
 /* the control registers for the four tile layers */
-volatile unsigned short* bg0_control = (volatile unsigned short*) 0x4000008;
-volatile unsigned short* bg1_control = (volatile unsigned short*) 0x400000a;
-volatile unsigned short* bg2_control = (volatile unsigned short*) 0x400000c;
+volatile unsigned short* bg0_control = (volatile unsigned short*) IO_ADDRESS(0x008);
+volatile unsigned short* bg1_control = (volatile unsigned short*) IO_ADDRESS(0x00a);
+volatile unsigned short* bg2_control = (volatile unsigned short*) IO_ADDRESS(0x00c);
+volatile unsigned short* bg3_control = (volatile unsigned short*) IO_ADDRESS(0x00e);
 
 /* palette is always 256 colors */
 #define PALETTE_SIZE 256
@@ -46,28 +61,32 @@ volatile unsigned short* bg2_control = (volatile unsigned short*) 0x400000c;
 #define NUM_SPRITES 128
 
 /* the display control pointer points to the gba graphics register */
-volatile unsigned long* display_control = (volatile unsigned long*) 0x4000000;
+volatile unsigned long* display_control = (volatile unsigned long*) IO_ADDRESS(0x000);
 
 /* the memory location which controls sprite attributes */
-volatile unsigned short* sprite_attribute_memory = (volatile unsigned short*) 0x7000000;
+volatile unsigned short* sprite_attribute_memory = (volatile unsigned short*) OAM_ADDRESS(0);
 
 /* the memory location which stores sprite image data */
-volatile unsigned short* sprite_image_memory = (volatile unsigned short*) 0x6010000;
+volatile unsigned short* sprite_image_memory = (volatile unsigned short*) VRAM_ADDRESS(0x10000);
 
 /* the address of the color palettes used for backgrounds and sprites */
-volatile unsigned short* bg_palette = (volatile unsigned short*) 0x5000000;
-volatile unsigned short* sprite_palette = (volatile unsigned short*) 0x5000200;
+volatile unsigned short* bg_palette = (volatile unsigned short*) PALETTE_ADDRESS(0);
+volatile unsigned short* sprite_palette = (volatile unsigned short*) PALETTE_ADDRESS(0x200);
 
 /* the button register holds the bits which indicate whether each button has
  * been pressed - this has got to be volatile as well
  */
-volatile unsigned short* buttons = (volatile unsigned short*) 0x04000130;
+volatile unsigned short* buttons = (volatile unsigned short*) IO_ADDRESS(0x130);
 
 /* scrolling registers for backgrounds */
-volatile short* bg0_x_scroll = (unsigned short*) 0x4000010;
-volatile short* bg0_y_scroll = (unsigned short*) 0x4000012;
-volatile short* bg1_x_scroll = (unsigned short*) 0x4000014;
-volatile short* bg1_y_scroll = (unsigned short*) 0x4000016;
+volatile short* bg0_x_scroll = (volatile short*) IO_ADDRESS(0x010);
+volatile short* bg0_y_scroll = (volatile short*) IO_ADDRESS(0x012);
+volatile short* bg1_x_scroll = (volatile short*) IO_ADDRESS(0x014);
+volatile short* bg1_y_scroll = (volatile short*) IO_ADDRESS(0x016);
+
+/* the blending registers, used to fade the whole screen to black */
+volatile unsigned short* blend_control = (volatile unsigned short*) IO_ADDRESS(0x050);
+volatile unsigned short* blend_brightness = (volatile unsigned short*) IO_ADDRESS(0x054);
 
 /* the bit positions indicate each button - the first bit is for A, second for
  * B, and so on, each constant below can be ANDED into the register to get the
@@ -85,71 +104,329 @@ volatile short* bg1_y_scroll = (unsigned short*) 0x4000016;
 
 /* the scanline counter is a memory cell which is updated to indicate how
  * much of the screen has been drawn */
-volatile unsigned short* scanline_counter = (volatile unsigned short*) 0x4000006;
+volatile unsigned short* scanline_counter = (volatile unsigned short*) IO_ADDRESS(0x006);
+
+/* the display status register, bit 3 asks for an interrupt at each vblank */
+volatile unsigned short* display_status = (volatile unsigned short*) IO_ADDRESS(0x004);
+#define DISPLAY_VBLANK_IRQ (1 << 3)
+
+/* the interrupt registers: which interrupts are enabled, which have fired, and
+ * the master switch which turns them all on or off */
+volatile unsigned short* interrupt_enable = (volatile unsigned short*) IO_ADDRESS(0x200);
+volatile unsigned short* interrupt_flags = (volatile unsigned short*) IO_ADDRESS(0x202);
+volatile unsigned short* master_interrupt_enable = (volatile unsigned short*) IO_ADDRESS(0x208);
+
+/* the BIOS keeps its own copy of the interrupt flags, which VBlankIntrWait
+ * checks to know when to wake up - our handler has to set it */
+volatile unsigned short* bios_interrupt_flags = (volatile unsigned short*) BIOS_FLAGS_ADDRESS;
+
+/* the bit for each interrupt in the registers above */
+#define INTERRUPT_VBLANK (1 << 0)
+
+/* the wait state control register, which sets how slow ROM accesses are */
+volatile unsigned short* wait_control = (volatile unsigned short*) IO_ADDRESS(0x204);
+
+/* 3 cycles for the first ROM access and 1 for each after it, instead of the
+ * 4 and 2 it starts with, plus the prefetch buffer, which fetches thumb code
+ * ahead while the CPU is busy - every cart can do this */
+#define WAIT_ROM_FAST 0x4317
+
+/* the number of vblanks since we turned the interrupt on, counted by the handler */
+volatile unsigned int vblank_count = 0;
+
+/* the number of frames the game has actually drawn */
+unsigned int frame_count = 0;
+
+/* the number of vblanks that went by while the game logic was still running */
+unsigned int missed_frames = 0;
+
+/* the most logic ticks we will run to catch up after going over budget */
+#define MAX_CATCHUP_TICKS 4
+
+void audio_vblank();
+
+/* called by the interrupt table at the start of every vblank */
+void on_vblank() {
+	vblank_count++;
 
-/* wait for the screen to be fully drawn so we can do something during vblank */
+	/* the next buffer of sound has to start right on time */
+	audio_vblank();
+
+	/* acknowledge the interrupt and tell the BIOS about it too */
+	*interrupt_flags = INTERRUPT_VBLANK;
+	*bios_interrupt_flags |= INTERRUPT_VBLANK;
+}
+
+/* turn on the vblank interrupt so on_vblank gets called every frame */
+void setup_interrupts() {
+	*master_interrupt_enable = 0;
+	*display_status |= DISPLAY_VBLANK_IRQ;
+	*interrupt_enable |= INTERRUPT_VBLANK;
+	*master_interrupt_enable = 1;
+}
+
+/* halt the CPU until the next vblank starts */
 void wait_vblank() {
-	/* wait until all 160 lines have been updated */
-	while (*scanline_counter < 160) { }
+	bios_vblank_wait();
+}
+
+/* where the keys for each tick come from */
+#define INPUT_LIVE 0
+#define INPUT_RECORD 1
+#define INPUT_REPLAY 2
+int input_mode = INPUT_LIVE;
+
+/* the keys held this tick, latched once so the whole tick sees the same
+ * thing - here a set bit means held, unlike the register */
+unsigned short input_keys = 0;
+
+/* a recording is a list of runs: the low 10 bits of each entry are the keys
+ * held, and the top 6 bits how many ticks in a row they were held, less one */
+#define INPUT_KEY_BITS 0x3ff
+#define INPUT_RUN_SHIFT 10
+#define INPUT_LONGEST_RUN 64
+
+/* room for 16384 runs: a run a tick if the keys change every tick, which
+ * is only about 4.5 minutes, up to 64 ticks a run if they're held */
+#define INPUT_MAX_RUNS 16384
+unsigned short input_recording[INPUT_MAX_RUNS] EWRAM_BSS;
+
+/* set once the recording is full, after which nothing more is added, so
+ * whoever saves it can say it stops short */
+int input_truncated = 0;
+
+/* the runs being recorded or replayed, and where we are in them */
+const unsigned short* input_runs = input_recording;
+unsigned int input_run_count = 0;
+unsigned int input_position = 0;
+unsigned int input_ticks_into_run = 0;
+
+/* start recording the keys from the next tick on */
+void input_record() {
+	input_mode = INPUT_RECORD;
+	input_runs = input_recording;
+	input_run_count = 0;
+	input_truncated = 0;
+}
+
+/* play back a recording instead of reading the buttons */
+void input_replay(const unsigned short* runs, unsigned int count) {
+	input_mode = INPUT_REPLAY;
+	input_runs = runs;
+	input_run_count = count;
+	input_position = 0;
+	input_ticks_into_run = 0;
+}
+
+/* whether a replay has reached its end */
+int input_replay_done() {
+	return input_mode == INPUT_REPLAY && input_position >= input_run_count;
+}
+
+/* add this tick's keys to the recording, making the last run longer if
+ * they haven't changed */
+void input_record_keys(unsigned short keys) {
+	if (input_truncated) {
+		return;
+	}
+	if (input_run_count > 0) {
+		unsigned short last = input_recording[input_run_count - 1];
+		int length = (last >> INPUT_RUN_SHIFT) + 1;
+		if ((last & INPUT_KEY_BITS) == keys && length < INPUT_LONGEST_RUN) {
+			input_recording[input_run_count - 1] = keys | (length << INPUT_RUN_SHIFT);
+			return;
+		}
+	}
+	if (input_run_count < INPUT_MAX_RUNS) {
+		input_recording[input_run_count++] = keys;
+	} else {
+		input_truncated = 1;
+	}
+}
+
+/* latch the keys for this tick */
+void input_update() {
+	if (input_mode == INPUT_REPLAY) {
+		/* once the replay runs out, nothing is held */
+		if (input_position >= input_run_count) {
+			input_keys = 0;
+			return;
+		}
+		unsigned short run = input_runs[input_position];
+		input_keys = run & INPUT_KEY_BITS;
+		if (++input_ticks_into_run > (unsigned int) (run >> INPUT_RUN_SHIFT)) {
+			input_position++;
+			input_ticks_into_run = 0;
+		}
+		return;
+	}
+
+	/* the register has a 0 bit for each key which is down */
+	input_keys = ~*buttons & INPUT_KEY_BITS;
+	if (input_mode == INPUT_RECORD) {
+		input_record_keys(input_keys);
+	}
 }
 
 /* this function checks whether a particular button has been pressed */
 unsigned char button_pressed(unsigned short button) {
-	/* and the button register with the button constant we want */
-	unsigned short pressed = *buttons & button;
+	/* and the latched keys with the button constant we want */
+	unsigned short pressed = input_keys & button;
 
 	/* if this value is zero, then it's not pressed */
 	if (pressed == 0) {
-		return 1;
-	} else {
 		return 0;
+	} else {
+		return 1;
 	}
 }
 
 /* return a pointer to one of the 4 character blocks (0-3) */
 volatile unsigned short* char_block(unsigned long block) {
 	/* they are each 16K big */
-	return (volatile unsigned short*) (0x6000000 + (block * 0x4000));
+	return (volatile unsigned short*) VRAM_ADDRESS(block * 0x4000);
 }
 
 /* return a pointer to one of the 32 screen blocks (0-31) */
 volatile unsigned short* screen_block(unsigned long block) {
 	/* they are each 2K big */
-	return (volatile unsigned short*) (0x6000000 + (block * 0x800));
+	return (volatile unsigned short*) VRAM_ADDRESS(block * 0x800);
+}
+
+/* copy data using DMA channel 3 */
+void memcpy16_dma(unsigned short* dest, unsigned short* source, int amount) {
+	while (dma_busy(3)) { }
+	dma_start(3, source, dest, amount | DMA_16 | DMA_ENABLE);
 }
 
-/* flag for turning on DMA */
-#define DMA_ENABLE 0x80000000
+/* a copy waiting for the next vblank */
+struct Transfer {
+	const unsigned char* source;
+	volatile unsigned char* dest;
+	unsigned int bytes;
+};
+
+/* the most copies that can be waiting at once */
+#define MAX_TRANSFERS 32
+
+/* how many bytes to copy in one vblank - DMA from ROM to VRAM moves about a
+ * word every 6 cycles, so this takes around a third of the 83776 cycles vblank
+ * lasts and leaves the rest for the game's other vblank work */
+#define DMA_BUDGET_BYTES 16384
+
+/* the waiting copies, oldest first, in a ring */
+struct Transfer transfers[MAX_TRANSFERS];
+int transfer_head = 0;
+int transfer_count = 0;
+
+/* how many bytes the last flush copied, and how many it left for later */
+unsigned int dma_bytes_flushed = 0;
+unsigned int dma_bytes_waiting = 0;
+
+/* ask for a copy to be done in the next vblank, returns 0 if the queue is full */
+int dma_queue(volatile void* dest, const void* source, unsigned int bytes) {
+	const unsigned char* s = (const unsigned char*) source;
+	volatile unsigned char* d = (volatile unsigned char*) dest;
+
+	/* if this carries straight on from the last copy, just make that one longer */
+	if (transfer_count > 0) {
+		struct Transfer* last = &transfers[(transfer_head + transfer_count - 1) % MAX_TRANSFERS];
+		if (last->source + last->bytes == s && last->dest + last->bytes == d) {
+			last->bytes += bytes;
+			dma_bytes_waiting += bytes;
+			return 1;
+		}
+	}
 
-/* flags for the sizes to transfer, 16 or 32 bits */
-#define DMA_16 0x00000000
-#define DMA_32 0x04000000
+	if (transfer_count == MAX_TRANSFERS) {
+		return 0;
+	}
 
-/* pointer to the DMA source location */
-volatile unsigned int* dma_source = (volatile unsigned int*) 0x40000D4;
+	struct Transfer* transfer = &transfers[(transfer_head + transfer_count) % MAX_TRANSFERS];
+	transfer->source = s;
+	transfer->dest = d;
+	transfer->bytes = bytes;
+	transfer_count++;
+	dma_bytes_waiting += bytes;
+	return 1;
+}
 
-/* pointer to the DMA destination location */
-volatile unsigned int* dma_destination = (volatile unsigned int*) 0x40000D8;
+/* do as many of the waiting copies as fit in this vblank, anything past the
+ * budget waits for the next one */
+void dma_flush() {
+	unsigned int budget = DMA_BUDGET_BYTES;
+	dma_bytes_flushed = 0;
 
-/* pointer to the DMA count/control */
-volatile unsigned int* dma_count = (volatile unsigned int*) 0x40000DC;
+	while (transfer_count > 0) {
+		struct Transfer* transfer = &transfers[transfer_head];
 
-/* copy data using DMA */
-void memcpy16_dma(unsigned short* dest, unsigned short* source, int amount) {
-	*dma_source = (unsigned int) source;
-	*dma_destination = (unsigned int) dest;
-	*dma_count = amount | DMA_16 | DMA_ENABLE;
+		/* split a copy which doesn't fit, keeping the pieces word aligned */
+		unsigned int bytes = transfer->bytes;
+		if (bytes > budget) {
+			bytes = budget & ~3;
+		}
+		if (bytes == 0) {
+			break;
+		}
+
+		/* copy in words when everything lines up, which takes half the time */
+		while (dma_busy(3)) { }
+		if ((((unsigned long) transfer->source | (unsigned long) transfer->dest | bytes) & 3) == 0) {
+			dma_start(3, transfer->source, transfer->dest, (bytes >> 2) | DMA_32 | DMA_ENABLE);
+		} else {
+			dma_start(3, transfer->source, transfer->dest, (bytes >> 1) | DMA_16 | DMA_ENABLE);
+		}
+
+		transfer->source += bytes;
+		transfer->dest += bytes;
+		transfer->bytes -= bytes;
+		budget -= bytes;
+		dma_bytes_flushed += bytes;
+		dma_bytes_waiting -= bytes;
+
+		if (transfer->bytes == 0) {
+			transfer_head = (transfer_head + 1) % MAX_TRANSFERS;
+			transfer_count--;
+		}
+	}
+}
+
+/* unpack an asset made by tools/gbapack straight into VRAM, using the BIOS */
+void load_asset(volatile void* dest, const unsigned int* asset) {
+	switch (ASSET_TYPE(asset[0])) {
+		case ASSET_LZ77:
+			bios_lz77_uncompress_vram(asset, dest);
+			break;
+		case ASSET_RLE:
+			bios_rle_uncompress_vram(asset, dest);
+			break;
+		case ASSET_HUFFMAN:
+			bios_huffman_uncompress(asset, dest);
+			break;
+		default:
+			/* raw data is padded to a whole number of words */
+			while (dma_busy(3)) { }
+			dma_start(3, asset + 1, dest, ((ASSET_SIZE(asset[0]) + 3) >> 2) | DMA_32 | DMA_ENABLE);
+			break;
+	}
+}
+
+/* wait as many vblanks as it takes to finish every waiting copy */
+void dma_flush_all() {
+	while (transfer_count > 0) {
+		wait_vblank();
+		dma_flush();
+	}
 }
 
 /* function to setup background 0 for this program */
 void setup_background() {
 
 	/* load the palette from the image into palette memory*/
-	memcpy16_dma((unsigned short*) bg_palette, (unsigned short*) background_palette, PALETTE_SIZE);
+	dma_queue(bg_palette, background_palette, PALETTE_SIZE * 2);
 
-	/* load the image into char block 0 */
-	memcpy16_dma((unsigned short*) char_block(0), (unsigned short*) background_data,
-			(background_width * background_height) / 2);
+	/* unpack the image into char block 0 */
+	load_asset(char_block(0), background_packed);
 
 	/* set all control the bits in this register */
 	*bg0_control = 2 |    /* priority, 0 is highest, 3 is lowest */
@@ -174,542 +451,3066 @@ void setup_background() {
 		(1 << 13) |       /* wrapping flag */
 		(0 << 14);        /* bg size, 0 is 256x256 */
 	
-   /*  load the tile data into screen block 16 
-	*/
-	/* load the tile data into screen block 16 */
-	memcpy16_dma((unsigned short*) screen_block(16), (unsigned short*) map, map_width * map_height);
-	memcpy16_dma((unsigned short*) screen_block(24), (unsigned short*) map2, map2_width * map2_height);
-	memcpy16_dma((unsigned short*) screen_block(8), (unsigned short*) map3, map3_width * map3_height);
+	/* the level is streamed into screen block 16 as it scrolls, see world_update */
+	load_asset(screen_block(24), map2_packed);
+	load_asset(screen_block(8), map3_packed);
 
 }
 
-/* just kill time */
-void delay(unsigned int amount) {
-	for (int i = 0; i < amount * 10; i++);
-}
+/* the screen block bg0 uses as a ring of 32 columns */
+#define WORLD_SCREEN_BLOCK 16
+#define WORLD_RING_COLUMNS 32
 
-/* a sprite is a moveable image on the screen */
-struct Sprite {
-	unsigned short attribute0;
-	unsigned short attribute1;
-	unsigned short attribute2;
-	unsigned short attribute3;
+/* a level in ROM, which can be as wide as it likes. bg0 only holds 32
+ * columns, so the visible ones are kept in it as a ring: world column c
+ * lives in column c & 31, and as the screen scrolls only the column which
+ * comes into view is written */
+struct World {
+	const unsigned short* tiles;
+	int width, height;
+
+	/* the world columns in the ring now, first to last, none if first > last */
+	int first, last;
 };
 
-/* array of all the sprites available on the GBA */
-struct Sprite sprites[NUM_SPRITES];
-int next_sprite_index = 0;
+struct World world;
 
-/* the different sizes of sprites which are possible */
-enum SpriteSize {
-	SIZE_8_8,
-	SIZE_16_16,
-	SIZE_32_32,
-	SIZE_64_64,
-	SIZE_16_8,
-	SIZE_32_8,
-	SIZE_32_16,
-	SIZE_64_32,
-	SIZE_8_16,
-	SIZE_8_32,
-	SIZE_16_32,
-	SIZE_32_64
-};
+/* how many columns have been written into the ring since the game started */
+unsigned int world_columns_written = 0;
 
-/* function to initialize a sprite with its properties, and return a pointer */
-struct Sprite* sprite_init(int x, int y, enum SpriteSize size, int horizontal_flip, int vertical_flip, int tile_index, int priority) {
+/* the DMA channel which feeds the scanline effects, the highest priority one
+ * so nothing holds it up during hblank */
+#define EFFECT_CHANNEL 0
 
-	/* grab the next index */
-	int index = next_sprite_index++;
+/* a scanline effect gives one or two registers next to each other a new
+ * value on every line, copied in by DMA during each hblank so the CPU does
+ * nothing. there are two tables so one can be built while the other is
+ * being shown, and they swap at vblank */
+struct Effect {
+	/* the first register, and how many */
+	volatile unsigned short* reg;
+	int count;
 
-	/* setup the bits used for each shape/size possible */
-	int size_bits, shape_bits;
-	switch (size) {
-		case SIZE_8_8:   size_bits = 0; shape_bits = 0; break;
-		case SIZE_16_16: size_bits = 1; shape_bits = 0; break;
-		case SIZE_32_32: size_bits = 2; shape_bits = 0; break;
-		case SIZE_64_64: size_bits = 3; shape_bits = 0; break;
-		case SIZE_16_8:  size_bits = 0; shape_bits = 1; break;
-		case SIZE_32_8:  size_bits = 1; shape_bits = 1; break;
-		case SIZE_32_16: size_bits = 2; shape_bits = 1; break;
-		case SIZE_64_32: size_bits = 3; shape_bits = 1; break;
-		case SIZE_8_16:  size_bits = 0; shape_bits = 2; break;
-		case SIZE_8_32:  size_bits = 1; shape_bits = 2; break;
-		case SIZE_16_32: size_bits = 2; shape_bits = 2; break;
-		case SIZE_32_64: size_bits = 3; shape_bits = 2; break;
-	}
+	/* the values for each line, count to a line; there's a line past the
+	 * bottom, since the hblank after the last line fetches one more */
+	unsigned short tables[2][(SCREEN_HEIGHT + 1) * 2] __attribute__((aligned(4)));
 
-	int h = horizontal_flip ? 1 : 0;
-	int v = vertical_flip ? 1 : 0;
+	/* which table is being shown, and whether the other one is ready */
+	int front;
+	int ready;
+	int running;
+};
 
-	/* set up the first attribute */
-	sprites[index].attribute0 = y |             /* y coordinate */
-							(0 << 8) |          /* rendering mode */
-							(0 << 10) |         /* gfx mode */
-							(0 << 12) |         /* mosaic */
-							(1 << 13) |         /* color mode, 0:16, 1:256 */
-							(shape_bits << 14); /* shape */
+struct Effect effect;
 
-	/* set up the second attribute */
-	sprites[index].attribute1 = x |             /* x coordinate */
-							(0 << 9) |          /* affine flag */
-							(h << 12) |         /* horizontal flip flag */
-							(v << 13) |         /* vertical flip flag */
-							(size_bits << 14);  /* size */
+/* set up an effect on one or two registers, given the offset of the first */
+void effect_init(struct Effect* effect, int offset, int count) {
+	dma_stop(EFFECT_CHANNEL);
+	effect->reg = (volatile unsigned short*) IO_ADDRESS(offset);
+	effect->count = count;
+	effect->front = 0;
+	effect->ready = 0;
+	effect->running = 0;
+}
 
-	/* setup the second attribute */
-	sprites[index].attribute2 = tile_index |   // tile index */
-							(priority << 10) | // priority */
-							(0 << 12);         // palette bank (only 16 color)*/
+/* the table to fill in for the next frame, count values for each line */
+unsigned short* effect_table(struct Effect* effect) {
+	return effect->tables[!effect->front];
+}
 
-	/* return pointer to this sprite */
-	return &sprites[index];
+/* the table is filled in, show it from the next frame on */
+void effect_commit(struct Effect* effect) {
+	unsigned short* table = effect->tables[!effect->front];
+	for (int i = 0; i < effect->count; i++) {
+		table[SCREEN_HEIGHT * effect->count + i] = table[i];
+	}
+	effect->ready = 1;
 }
 
-/* update all of the spries on the screen */
-void sprite_update_all() {
-	/* copy them all over */
-	memcpy16_dma((unsigned short*) sprite_attribute_memory, (unsigned short*) sprites, NUM_SPRITES * 4);
+/* called in vblank: swap in a new table if there is one, set the registers
+ * for the first line, and start the DMA again from the second */
+void effect_vblank(struct Effect* effect) {
+	if (effect->ready) {
+		effect->front = !effect->front;
+		effect->ready = 0;
+		effect->running = 1;
+	}
+	if (!effect->running) {
+		return;
+	}
+
+	const unsigned short* table = effect->tables[effect->front];
+	dma_stop(EFFECT_CHANNEL);
+	for (int i = 0; i < effect->count; i++) {
+		effect->reg[i] = table[i];
+	}
+	dma_start(EFFECT_CHANNEL, table + effect->count, effect->reg,
+			DMA_ENABLE | DMA_HBLANK | DMA_REPEAT | DMA_DEST_RELOAD |
+			(effect->count == 2 ? DMA_32 | 1 : DMA_16 | 1));
 }
 
-/* setup all sprites */
-void sprite_clear() {
-	/* clear the index counter */
-	next_sprite_index = 0;
+/* stop changing the registers, leaving them as they are for the top line */
+void effect_stop(struct Effect* effect) {
+	dma_stop(EFFECT_CHANNEL);
+	effect->running = 0;
+	effect->ready = 0;
+	for (int i = 0; i < effect->count; i++) {
+		effect->reg[i] = 0;
+	}
+}
 
-	/* move all sprites offscreen to hide them */
-	for(int i = 0; i < NUM_SPRITES; i++) {
-		sprites[i].attribute0 = SCREEN_HEIGHT;
-		sprites[i].attribute1 = SCREEN_WIDTH;
+/* the parallax bands of bg1, from the top: the line each one ends on, and
+ * how far it moves for each pixel the level does, in 1/256ths */
+#define PARALLAX_BANDS 3
+const unsigned char parallax_ends[PARALLAX_BANDS] = {48, 96, SCREEN_HEIGHT};
+const unsigned short parallax_speeds[PARALLAX_BANDS] = {64, 128, 256};
+
+/* build bg1's horizontal scroll for each line, further bands move slower */
+void parallax_build(struct Effect* effect, int xscroll) {
+	unsigned short* table = effect_table(effect);
+	int line = 0;
+	for (int band = 0; band < PARALLAX_BANDS; band++) {
+		unsigned short x = (xscroll * parallax_speeds[band]) >> 8;
+		for (; line < parallax_ends[band]; line++) {
+			table[line] = x;
+		}
 	}
+	effect_commit(effect);
 }
 
-/* set a sprite postion */
-void sprite_position(struct Sprite* sprite, int x, int y) {
-	/* clear out the y coordinate */
-	sprite->attribute0 &= 0xff00;
+/* the parts of a frame the profiler times */
+#define PROFILE_TICK 0
+#define PROFILE_INPUT 1
+#define PROFILE_FALCO 2
+#define PROFILE_ENEMIES 3
+#define PROFILE_COLLISION 4
+#define PROFILE_VBLANK 5
+#define PROFILE_SPRITES 6
+#define PROFILE_AUDIO 7
+#define PROFILE_ZONES 8
+
+const char profile_names[PROFILE_ZONES][8] = {
+	"tick", "input", "falco", "enemies", "collide", "vblank", "sprites", "audio"
+};
 
-	/* set the new y coordinate */
-	sprite->attribute0 |= (y & 0xff);
+/* the stats are over this many frames at a time, a power of two */
+#define PROFILE_WINDOW_SHIFT 6
+
+/* the CPU's cycles in one frame, 228 lines of 1232 */
+#define CYCLES_PER_FRAME 280896
+
+/* the cycles each zone has taken so far this frame, when the one running
+ * now started, and the stats over the window being counted */
+unsigned int profile_start[PROFILE_ZONES];
+unsigned int profile_frame_cycles[PROFILE_ZONES];
+unsigned int profile_min[PROFILE_ZONES];
+unsigned int profile_max[PROFILE_ZONES];
+unsigned int profile_sum[PROFILE_ZONES];
+unsigned int profile_frames = 0;
+
+/* the min, average and max cycles a frame for each zone over the last
+ * complete window */
+struct ProfileStats {
+	unsigned int min, avg, max;
+};
+struct ProfileStats profile_stats[PROFILE_ZONES];
 
-	/* clear out the x coordinate */
-	sprite->attribute1 &= 0xfe00;
+/* time a zone, a zone can be timed more than once a frame */
+static inline void profile_begin(int zone) {
+	profile_start[zone] = cycle_counter();
+}
+static inline void profile_end(int zone) {
+	profile_frame_cycles[zone] += cycle_counter() - profile_start[zone];
+}
 
-	/* set the new x coordinate */
-	sprite->attribute1 |= (x & 0x1ff);
+/* start the cycle counter and clear the stats */
+void profile_init() {
+	cycle_counter_start();
+	for (int zone = 0; zone < PROFILE_ZONES; zone++) {
+		profile_frame_cycles[zone] = 0;
+		profile_min[zone] = 0xffffffff;
+		profile_max[zone] = 0;
+		profile_sum[zone] = 0;
+	}
+	profile_frames = 0;
 }
 
-/* move a sprite in a direction */
-void sprite_move(struct Sprite* sprite, int dx, int dy) {
-	/* get the current y coordinate */
-	int y = sprite->attribute0 & 0xff;
+/* add this frame's times to the window, and when the window is full, make
+ * it the stats which are shown */
+void profile_frame() {
+	for (int zone = 0; zone < PROFILE_ZONES; zone++) {
+		unsigned int cycles = profile_frame_cycles[zone];
+		profile_frame_cycles[zone] = 0;
+		if (cycles < profile_min[zone]) {
+			profile_min[zone] = cycles;
+		}
+		if (cycles > profile_max[zone]) {
+			profile_max[zone] = cycles;
+		}
+		profile_sum[zone] += cycles;
+	}
 
-	/* get the current x coordinate */
-	int x = sprite->attribute1 & 0x1ff;
+	if (++profile_frames == (1 << PROFILE_WINDOW_SHIFT)) {
+		for (int zone = 0; zone < PROFILE_ZONES; zone++) {
+			profile_stats[zone].min = profile_min[zone];
+			profile_stats[zone].avg = profile_sum[zone] >> PROFILE_WINDOW_SHIFT;
+			profile_stats[zone].max = profile_max[zone];
+			profile_min[zone] = 0xffffffff;
+			profile_max[zone] = 0;
+			profile_sum[zone] = 0;
+		}
+		profile_frames = 0;
+	}
+}
 
-	/* move to the new location */
-	sprite_position(sprite, x + dx, y + dy);
+/* where the last stats are saved in SRAM: "PROF", the number of zones, then
+ * for each one its name in 8 bytes and min, avg and max as 32 bit little
+ * endian numbers - SRAM is only 8 bits wide so it goes a byte at a time */
+#define PROFILE_SRAM_OFFSET 0x7000
+
+void profile_dump() {
+	volatile unsigned char* sram = (volatile unsigned char*) SRAM_ADDRESS(PROFILE_SRAM_OFFSET);
+	const char* magic = "PROF";
+	for (int i = 0; i < 4; i++) {
+		*sram++ = magic[i];
+	}
+	*sram++ = PROFILE_ZONES;
+	for (int zone = 0; zone < PROFILE_ZONES; zone++) {
+		for (int i = 0; i < 8; i++) {
+			*sram++ = profile_names[zone][i];
+		}
+		unsigned int values[3] = {profile_stats[zone].min, profile_stats[zone].avg, profile_stats[zone].max};
+		for (int v = 0; v < 3; v++) {
+			for (int i = 0; i < 32; i += 8) {
+				*sram++ = values[v] >> i;
+			}
+		}
+	}
 }
 
-/* change the vertical flip flag */
-void sprite_set_vertical_flip(struct Sprite* sprite, int vertical_flip) {
-	if (vertical_flip) {
-		/* set the bit */
-		sprite->attribute1 |= 0x2000;
-	} else {
-		/* clear the bit */
-		sprite->attribute1 &= 0xdfff;
+/* the overlay is a bar for each zone on bg2, the length of its average
+ * cycles with a tick at its max, where the width of the screen is a whole
+ * frame. it uses spare tiles and a spare screen block after bg1's map */
+#define OVERLAY_CHAR_BLOCK 3
+#define OVERLAY_SCREEN_BLOCK 30
+#define OVERLAY_FIRST_TILE 32
+#define OVERLAY_BLANK OVERLAY_FIRST_TILE
+#define OVERLAY_FILL (OVERLAY_FIRST_TILE + 1)
+#define OVERLAY_TICK (OVERLAY_FIRST_TILE + 9)
+#define OVERLAY_COLOR 255
+#define CYCLES_PER_PIXEL (CYCLES_PER_FRAME / SCREEN_WIDTH)
+
+/* select plus L shows and hides the overlay, select plus R saves to SRAM */
+#define PROFILE_TOGGLE_KEYS (BUTTON_SELECT | BUTTON_L)
+#define PROFILE_DUMP_KEYS (BUTTON_SELECT | BUTTON_R)
+
+int overlay_shown = 0;
+unsigned short overlay_saved_color;
+unsigned short overlay_saved_control;
+unsigned short profile_last_keys = 0;
+
+/* make the overlay's tiles: a blank one, ones filled from the left by 1 to
+ * 8 pixels, and ones with a single column set, 256 colors so a byte each */
+void overlay_make_tiles() {
+	volatile unsigned short* tiles = char_block(OVERLAY_CHAR_BLOCK) + OVERLAY_FIRST_TILE * 32;
+	for (int tile = 0; tile < 17; tile++) {
+		for (int y = 0; y < 8; y++) {
+			for (int x = 0; x < 8; x += 2) {
+				unsigned short pair = 0;
+				for (int i = 0; i < 2; i++) {
+					int set = tile == 0 ? 0 : tile <= 8 ? x + i < tile : x + i == tile - 9;
+					/* leave a gap between the rows of bars */
+					if (set && y > 0 && y < 7) {
+						pair |= OVERLAY_COLOR << (i * 8);
+					}
+				}
+				tiles[tile * 32 + y * 4 + x / 2] = pair;
+			}
+		}
 	}
 }
 
-/* change the vertical flip flag */
-void sprite_set_horizontal_flip(struct Sprite* sprite, int horizontal_flip) {
-	if (horizontal_flip) {
-		/* set the bit */
-		sprite->attribute1 |= 0x1000;
+/* put the overlay on the screen, or take it off */
+void overlay_show(int shown) {
+	if (shown == overlay_shown) {
+		return;
+	}
+	overlay_shown = shown;
+	if (shown) {
+		overlay_make_tiles();
+
+		/* overlay_draw only writes the rows with bars, so blank the whole
+		 * screen block first or whatever was in VRAM would show around them */
+		volatile unsigned short* map = screen_block(OVERLAY_SCREEN_BLOCK);
+		for (int i = 0; i < 32 * 32; i++) {
+			map[i] = OVERLAY_BLANK;
+		}
+
+		overlay_saved_color = bg_palette[OVERLAY_COLOR];
+		overlay_saved_control = *bg2_control;
+		bg_palette[OVERLAY_COLOR] = 0x7fff;
+		*bg2_control = 0 | (OVERLAY_CHAR_BLOCK << 2) | (1 << 7) | (OVERLAY_SCREEN_BLOCK << 8);
+		*display_control |= BG2_ENABLE;
 	} else {
-		/* clear the bit */
-		sprite->attribute1 &= 0xefff;
+		*display_control &= ~BG2_ENABLE;
+		*bg2_control = overlay_saved_control;
+		bg_palette[OVERLAY_COLOR] = overlay_saved_color;
 	}
 }
 
-/* change the tile offset of a sprite */
-void sprite_set_offset(struct Sprite* sprite, int offset) {
-	/* clear the old offset */
-	sprite->attribute2 &= 0xfc00;
+/* look for the key combinations, once each time they are pressed */
+void profile_input() {
+	unsigned short keys = input_keys;
+	unsigned short pressed = keys & ~profile_last_keys;
+	profile_last_keys = keys;
+	if ((keys & PROFILE_TOGGLE_KEYS) == PROFILE_TOGGLE_KEYS && (pressed & PROFILE_TOGGLE_KEYS)) {
+		overlay_show(!overlay_shown);
+	}
+	if ((keys & PROFILE_DUMP_KEYS) == PROFILE_DUMP_KEYS && (pressed & PROFILE_DUMP_KEYS)) {
+		profile_dump();
+	}
+}
 
-	/* apply the new one */
-	sprite->attribute2 |= (offset & 0x03ff);
+/* draw the bars into the overlay's screen block, in vblank */
+void overlay_draw() {
+	if (!overlay_shown) {
+		return;
+	}
+	volatile unsigned short* map = screen_block(OVERLAY_SCREEN_BLOCK);
+	for (int zone = 0; zone < PROFILE_ZONES; zone++) {
+		int avg = profile_stats[zone].avg / CYCLES_PER_PIXEL;
+		int max = profile_stats[zone].max / CYCLES_PER_PIXEL;
+		volatile unsigned short* row = map + (zone + 1) * 32;
+		for (int cell = 0; cell < 30; cell++) {
+			int fill = avg - cell * 8;
+			int tile;
+			if (fill >= 8) {
+				tile = OVERLAY_FILL + 7;
+			} else if (fill > 0) {
+				tile = OVERLAY_FILL + fill - 1;
+			} else if (max >= cell * 8 && max < cell * 8 + 8) {
+				tile = OVERLAY_TICK + max - cell * 8;
+			} else {
+				tile = OVERLAY_BLANK;
+			}
+			row[cell] = tile;
+		}
+	}
 }
 
-/* setup the sprite image and palette */
-void setup_sprite_image() {
-	/* load the palette from the image into palette memory*/
-	memcpy16_dma((unsigned short*) sprite_palette, (unsigned short*) spritesheet_palette, PALETTE_SIZE);
+/* start streaming a level, nothing is in the ring until the next update */
+void world_init(struct World* world, const unsigned short* tiles, int width, int height) {
+	world->tiles = tiles;
+	world->width = width;
+	world->height = height < 32 ? height : 32;
+	world->first = 0;
+	world->last = -1;
+}
 
-	/* load the image into sprite image memory */
-	memcpy16_dma((unsigned short*) sprite_image_memory, (unsigned short*) spritesheet_data, (spritesheet_width * spritesheet_height) / 2);
+/* copy one world column into its place in the ring - the rows are 64 bytes
+ * apart in the screen block, so this is a loop rather than a DMA */
+void world_write_column(struct World* world, int column) {
+	int x = column % world->width;
+	if (x < 0) {
+		x += world->width;
+	}
+	const unsigned short* source = world->tiles + x;
+	volatile unsigned short* dest = screen_block(WORLD_SCREEN_BLOCK) + (column & (WORLD_RING_COLUMNS - 1));
+	for (int row = 0; row < world->height; row++) {
+		dest[row * 32] = source[row * world->width];
+	}
+	world_columns_written++;
 }
 
-/* a struct for Falco's logic and behavior */
-struct Falco {
-	/* the actual sprite attribute info */
-	struct Sprite* sprite;
+/* make sure every column visible at a scroll position is in the ring; this
+ * writes to VRAM so it goes in vblank. scrolling a pixel at a time means
+ * at most one new column a frame, however long the level */
+void world_update(struct World* world, int xscroll) {
+	int left = xscroll >> 3;
+	int right = (xscroll + SCREEN_WIDTH - 1) >> 3;
+
+	/* jumped somewhere else entirely, fill in the whole screen */
+	if (world->first > world->last || right < world->first || left > world->last) {
+		for (int column = left; column <= right; column++) {
+			world_write_column(world, column);
+		}
+		world->first = left;
+		world->last = right;
+		return;
+	}
 
-	/* the x and y postion, in 1/256 pixels */
-	int x, y;
+	/* otherwise just the new columns on either side */
+	for (int column = left; column < world->first; column++) {
+		world_write_column(world, column);
+	}
+	for (int column = world->last + 1; column <= right; column++) {
+		world_write_column(world, column);
+	}
 
-	/* the falco's y velocity in 1/256 pixels/second */
-	int yvel;
+	/* the ring only holds so many, new ones overwrite the far side */
+	if (left < world->first) {
+		world->first = left;
+		if (world->last - world->first >= WORLD_RING_COLUMNS) {
+			world->last = world->first + WORLD_RING_COLUMNS - 1;
+		}
+	}
+	if (right > world->last) {
+		world->last = right;
+		if (world->last - world->first >= WORLD_RING_COLUMNS) {
+			world->first = world->last - WORLD_RING_COLUMNS + 1;
+		}
+	}
+}
 
-	/* the falco's y acceleration in 1/256 pixels/second^2 */
-	int gravity; 
+/* the HUD is a layer of text on bg3, in 16 colors from the last palette
+ * bank, which mkassets leaves free. the font goes in char block 3 after
+ * bg1's map and the overlay's tiles, and the text in screen block 31 */
+#define HUD_CHAR_BLOCK 3
+#define HUD_SCREEN_BLOCK 31
+#define HUD_FIRST_TILE 112
+#define HUD_PALETTE_BANK 15
+#define HUD_COLUMNS 30
+#define HUD_ROWS 20
+#define HUD_CELLS (HUD_COLUMNS * HUD_ROWS)
+
+/* the colors of the letters and of the shadow under them */
+#define HUD_TEXT 1
+#define HUD_SHADOW 2
+
+/* the characters the font has, anything else shows as a space and
+ * lowercase letters as capitals */
+const char hud_font_chars[] = " 0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ:-./%!?";
+
+/* a row of each character a byte, the leftmost pixel in the top bit */
+const unsigned char hud_font[][8] = {
+	{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* space */
+	{0x38, 0x44, 0x4c, 0x54, 0x64, 0x44, 0x38, 0x00}, /* 0 */
+	{0x10, 0x30, 0x10, 0x10, 0x10, 0x10, 0x38, 0x00}, /* 1 */
+	{0x38, 0x44, 0x04, 0x08, 0x10, 0x20, 0x7c, 0x00}, /* 2 */
+	{0x7c, 0x08, 0x10, 0x08, 0x04, 0x44, 0x38, 0x00}, /* 3 */
+	{0x08, 0x18, 0x28, 0x48, 0x7c, 0x08, 0x08, 0x00}, /* 4 */
+	{0x7c, 0x40, 0x78, 0x04, 0x04, 0x44, 0x38, 0x00}, /* 5 */
+	{0x18, 0x20, 0x40, 0x78, 0x44, 0x44, 0x38, 0x00}, /* 6 */
+	{0x7c, 0x04, 0x08, 0x10, 0x20, 0x20, 0x20, 0x00}, /* 7 */
+	{0x38, 0x44, 0x44, 0x38, 0x44, 0x44, 0x38, 0x00}, /* 8 */
+	{0x38, 0x44, 0x44, 0x3c, 0x04, 0x08, 0x30, 0x00}, /* 9 */
+	{0x38, 0x44, 0x44, 0x7c, 0x44, 0x44, 0x44, 0x00}, /* A */
+	{0x78, 0x44, 0x44, 0x78, 0x44, 0x44, 0x78, 0x00}, /* B */
+	{0x38, 0x44, 0x40, 0x40, 0x40, 0x44, 0x38, 0x00}, /* C */
+	{0x70, 0x48, 0x44, 0x44, 0x44, 0x48, 0x70, 0x00}, /* D */
+	{0x7c, 0x40, 0x40, 0x78, 0x40, 0x40, 0x7c, 0x00}, /* E */
+	{0x7c, 0x40, 0x40, 0x78, 0x40, 0x40, 0x40, 0x00}, /* F */
+	{0x38, 0x44, 0x40, 0x5c, 0x44, 0x44, 0x3c, 0x00}, /* G */
+	{0x44, 0x44, 0x44, 0x7c, 0x44, 0x44, 0x44, 0x00}, /* H */
+	{0x38, 0x10, 0x10, 0x10, 0x10, 0x10, 0x38, 0x00}, /* I */
+	{0x1c, 0x08, 0x08, 0x08, 0x08, 0x48, 0x30, 0x00}, /* J */
+	{0x44, 0x48, 0x50, 0x60, 0x50, 0x48, 0x44, 0x00}, /* K */
+	{0x40, 0x40, 0x40, 0x40, 0x40, 0x40, 0x7c, 0x00}, /* L */
+	{0x44, 0x6c, 0x54, 0x54, 0x44, 0x44, 0x44, 0x00}, /* M */
+	{0x44, 0x44, 0x64, 0x54, 0x4c, 0x44, 0x44, 0x00}, /* N */
+	{0x38, 0x44, 0x44, 0x44, 0x44, 0x44, 0x38, 0x00}, /* O */
+	{0x78, 0x44, 0x44, 0x78, 0x40, 0x40, 0x40, 0x00}, /* P */
+	{0x38, 0x44, 0x44, 0x44, 0x54, 0x48, 0x34, 0x00}, /* Q */
+	{0x78, 0x44, 0x44, 0x78, 0x50, 0x48, 0x44, 0x00}, /* R */
+	{0x3c, 0x40, 0x40, 0x38, 0x04, 0x04, 0x78, 0x00}, /* S */
+	{0x7c, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x00}, /* T */
+	{0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x38, 0x00}, /* U */
+	{0x44, 0x44, 0x44, 0x44, 0x44, 0x28, 0x10, 0x00}, /* V */
+	{0x44, 0x44, 0x44, 0x54, 0x54, 0x54, 0x28, 0x00}, /* W */
+	{0x44, 0x44, 0x28, 0x10, 0x28, 0x44, 0x44, 0x00}, /* X */
+	{0x44, 0x44, 0x28, 0x10, 0x10, 0x10, 0x10, 0x00}, /* Y */
+	{0x7c, 0x04, 0x08, 0x10, 0x20, 0x40, 0x7c, 0x00}, /* Z */
+	{0x00, 0x30, 0x30, 0x00, 0x30, 0x30, 0x00, 0x00}, /* : */
+	{0x00, 0x00, 0x00, 0x7c, 0x00, 0x00, 0x00, 0x00}, /* - */
+	{0x00, 0x00, 0x00, 0x00, 0x00, 0x30, 0x30, 0x00}, /* . */
+	{0x00, 0x04, 0x08, 0x10, 0x20, 0x40, 0x00, 0x00}, /* / */
+	{0x60, 0x64, 0x08, 0x10, 0x20, 0x4c, 0x0c, 0x00}, /* % */
+	{0x10, 0x10, 0x10, 0x10, 0x10, 0x00, 0x10, 0x00}, /* ! */
+	{0x38, 0x44, 0x04, 0x08, 0x10, 0x00, 0x10, 0x00}, /* ? */
+};
 
-	/* which frame of the animation he is on */
-	int frame;
+/* what each cell of the HUD should show, as screen block entries, and the
+ * cells which have changed since the last vblank */
+unsigned short hud_cells[HUD_CELLS];
+unsigned short hud_dirty[HUD_CELLS];
+unsigned char hud_queued[HUD_CELLS];
+int hud_dirty_count = 0;
+
+/* the font tile for each character code */
+unsigned char hud_glyphs[128];
+
+/* how many cells the last hud_flush wrote */
+int hud_cells_written = 0;
+
+/* make the font's tiles, 4 bits a pixel, with a shadow down and right */
+void hud_make_tiles() {
+	volatile unsigned short* tiles = char_block(HUD_CHAR_BLOCK) + HUD_FIRST_TILE * 16;
+	int count = sizeof(hud_font) / sizeof(hud_font[0]);
+	for (int glyph = 0; glyph < count; glyph++) {
+		for (int y = 0; y < 8; y++) {
+			unsigned char row = hud_font[glyph][y];
+			unsigned char above = y > 0 ? hud_font[glyph][y - 1] : 0;
+			for (int x = 0; x < 8; x += 4) {
+				unsigned short pixels = 0;
+				for (int i = 0; i < 4; i++) {
+					int bit = 0x80 >> (x + i);
+					int color = (row & bit) ? HUD_TEXT : (above & (bit << 1)) ? HUD_SHADOW : 0;
+					pixels |= color << (i * 4);
+				}
+				tiles[glyph * 16 + y * 2 + x / 4] = pixels;
+			}
+		}
+	}
 
-	/* the number of frames to wait before flipping */
-	int animation_delay;
+	for (int c = 0; c < 128; c++) {
+		hud_glyphs[c] = 0;
+	}
+	for (int glyph = 0; glyph < count; glyph++) {
+		hud_glyphs[(int) hud_font_chars[glyph]] = glyph;
+	}
+	for (int c = 'a'; c <= 'z'; c++) {
+		hud_glyphs[c] = hud_glyphs[c - 'a' + 'A'];
+	}
+}
 
-	/* the animation counter counts how many frames until we flip */
-	int counter;
+/* set up bg3 with an empty HUD on it */
+void hud_init() {
+	hud_make_tiles();
+	bg_palette[HUD_PALETTE_BANK * 16 + HUD_TEXT] = 0x7fff;
+	bg_palette[HUD_PALETTE_BANK * 16 + HUD_SHADOW] = 0x0000;
+
+	*bg3_control = 0 |    /* priority, 0 is highest, 3 is lowest */
+		(HUD_CHAR_BLOCK << 2) |   /* the char block the font is stored in */
+		(0 << 7) |                /* color mode, 0 is 16 colors, 1 is 256 colors */
+		(HUD_SCREEN_BLOCK << 8);  /* the screen block the text is stored in */
+
+	/* blank every cell now, the display might not be showing yet */
+	unsigned short blank = (HUD_FIRST_TILE + hud_glyphs[' ']) | (HUD_PALETTE_BANK << 12);
+	volatile unsigned short* map = screen_block(HUD_SCREEN_BLOCK);
+	for (int i = 0; i < 32 * 32; i++) {
+		map[i] = blank;
+	}
+	for (int i = 0; i < HUD_CELLS; i++) {
+		hud_cells[i] = blank;
+		hud_queued[i] = 0;
+	}
+	hud_dirty_count = 0;
+	*display_control |= BG3_ENABLE;
+}
 
-	/* whether the falco is moving right now or not */
-	int move;
+/* show a character in a cell, if it isn't showing it already */
+void hud_put(int column, int row, char c) {
+	if (column < 0 || column >= HUD_COLUMNS || row < 0 || row >= HUD_ROWS) {
+		return;
+	}
+	int cell = row * HUD_COLUMNS + column;
+	unsigned short entry = (HUD_FIRST_TILE + hud_glyphs[c & 0x7f]) | (HUD_PALETTE_BANK << 12);
+	if (hud_cells[cell] == entry) {
+		return;
+	}
+	hud_cells[cell] = entry;
+	if (!hud_queued[cell]) {
+		hud_queued[cell] = 1;
+		hud_dirty[hud_dirty_count++] = cell;
+	}
+}
 
-	/* the number of pixels away from the edge of the screen the falco stays */
-	int border;
+/* print a string from a cell onwards, returns the column after it */
+int hud_print(int column, int row, const char* text) {
+	while (*text) {
+		hud_put(column++, row, *text++);
+	}
+	return column;
+}
 
-	/* if the falco is currently falling */
-	int falling;
+/* print a number right aligned in a number of columns, with spaces in
+ * front, or as many digits as it needs if it is too wide */
+int hud_print_number(int column, int row, int value, int width) {
+	char digits[12];
+	int count = 0;
+	unsigned int magnitude = value < 0 ? -(unsigned int) value : (unsigned int) value;
+	do {
+		digits[count++] = '0' + magnitude % 10;
+		magnitude /= 10;
+	} while (magnitude > 0);
+	if (value < 0) {
+		digits[count++] = '-';
+	}
 
-	//if falco is facing left = 0, right = 1
-	int facing;
+	while (width-- > count) {
+		hud_put(column++, row, ' ');
+	}
+	while (count > 0) {
+		hud_put(column++, row, digits[--count]);
+	}
+	return column;
+}
 
-	//Score of how many times he shot a shyguy
-	int score;
-};
+/* blank every cell, they go out with the next flush */
+void hud_clear() {
+	for (int row = 0; row < HUD_ROWS; row++) {
+		for (int column = 0; column < HUD_COLUMNS; column++) {
+			hud_put(column, row, ' ');
+		}
+	}
+}
+
+/* write the cells which changed into the screen block, in vblank */
+void hud_flush() {
+	volatile unsigned short* map = screen_block(HUD_SCREEN_BLOCK);
+	for (int i = 0; i < hud_dirty_count; i++) {
+		int cell = hud_dirty[i];
+		int row = cell / HUD_COLUMNS;
+		map[row * 32 + cell - row * HUD_COLUMNS] = hud_cells[cell];
+		hud_queued[cell] = 0;
+	}
+	hud_cells_written = hud_dirty_count;
+	hud_dirty_count = 0;
+}
+
+/* sound goes out through the two Direct Sound channels, each fed 8 bit
+ * samples by a DMA channel whenever its FIFO runs low, at the rate timer 0
+ * overflows: FIFO A plays the music and FIFO B the sound effects, each mixed
+ * from a few voices into a buffer a frame long */
+#define AUDIO_PERIOD 924
+#define AUDIO_RATE 18157
+#define AUDIO_SAMPLES 304
+#define AUDIO_MUSIC_CHANNEL 1
+#define AUDIO_EFFECT_CHANNEL 2
+
+/* the sound registers, timer 0, and the two FIFOs */
+volatile unsigned short* sound_control = (volatile unsigned short*) IO_ADDRESS(0x082);
+volatile unsigned short* sound_status = (volatile unsigned short*) IO_ADDRESS(0x084);
+volatile unsigned short* timer0_reload = (volatile unsigned short*) IO_ADDRESS(0x100);
+volatile unsigned short* timer0_control = (volatile unsigned short*) IO_ADDRESS(0x102);
+volatile unsigned int* fifo_a = (volatile unsigned int*) IO_ADDRESS(0x0a0);
+volatile unsigned int* fifo_b = (volatile unsigned int*) IO_ADDRESS(0x0a4);
+
+/* the first voices play the music, the rest the sound effects - the mixer
+ * takes a few cycles a sample for each voice which is playing, so how many
+ * there are is what keeps it inside its share of the frame */
+#define AUDIO_MUSIC_VOICES 2
+#define AUDIO_VOICES 5
+
+/* positions in a sample have this many bits below the point */
+#define AUDIO_FRACTION 12
+
+/* a voice plays a sample from its position, moving on step each output
+ * sample; one which loops plays the whole sample, a power of two long, over
+ * and over, and one which doesn't goes quiet at its end */
+struct Voice {
+	const signed char* data;
+	unsigned int position;
+	unsigned int step;
+	unsigned int end;
+	int loop;
+	int volume;
+};
+
+struct Voice voices[AUDIO_VOICES];
+
+/* two buffers for each FIFO, one playing while the other is mixed, in the
+ * external work RAM which DMA can read while the CPU is busy elsewhere */
+signed char audio_music_buffers[2][AUDIO_SAMPLES] EWRAM_BSS __attribute__((aligned(4)));
+signed char audio_effect_buffers[2][AUDIO_SAMPLES] EWRAM_BSS __attribute__((aligned(4)));
+
+/* the voices are added up here before being cut down to 8 bits */
+int audio_mix_buffer[AUDIO_SAMPLES];
+
+/* which buffer is playing, and whether the other one has been mixed */
+int audio_playing = 0;
+int audio_mixed = 0;
+int audio_running = 0;
+
+/* the sound effects, made when the game starts */
+#define SOUND_LASER 0
+#define SOUND_HIT 1
+#define SOUND_DEATH 2
+#define SOUNDS 3
+
+#define SOUND_LASER_LENGTH 2400
+#define SOUND_HIT_LENGTH 2000
+#define SOUND_DEATH_LENGTH 12000
+
+signed char sound_laser[SOUND_LASER_LENGTH] EWRAM_BSS;
+signed char sound_hit[SOUND_HIT_LENGTH] EWRAM_BSS;
+signed char sound_death[SOUND_DEATH_LENGTH] EWRAM_BSS;
+
+struct Sound {
+	const signed char* data;
+	int length;
+};
+
+const struct Sound sounds[SOUNDS] = {
+	{sound_laser, SOUND_LASER_LENGTH},
+	{sound_hit, SOUND_HIT_LENGTH},
+	{sound_death, SOUND_DEATH_LENGTH},
+};
+
+/* the music's instruments, a single cycle of a wave each */
+#define WAVE_LENGTH 32
+signed char wave_square[WAVE_LENGTH];
+signed char wave_triangle[WAVE_LENGTH];
+
+/* make a sound effect: a square wave sweeping from one pitch to another, or
+ * noise, fading out to nothing by the end */
+void sound_make(signed char* data, int length, int from_hz, int to_hz, int noise) {
+	/* the phase goes round once every 65536, the step and the volume are in
+	 * 1/256ths so they can change a little each sample */
+	int step = from_hz * 65536 / AUDIO_RATE * 256;
+	int step_change = (to_hz - from_hz) * 65536 / AUDIO_RATE * 256 / length;
+	int volume = 120 << 8;
+	int volume_change = volume / length;
+	unsigned int phase = 0;
+	unsigned int random = 1;
+
+	for (int i = 0; i < length; i++) {
+		int level;
+		if (noise) {
+			/* a 15 bit shift register, the way the GB noise channel does it */
+			random = (random >> 1) | (((random ^ (random >> 1)) & 1) << 14);
+			level = (random & 1) ? 1 : -1;
+		} else {
+			phase += step >> 8;
+			level = (phase & 0x8000) ? 1 : -1;
+		}
+		data[i] = level * (volume >> 8);
+		step += step_change;
+		volume -= volume_change;
+	}
+}
+
+/* make the waves and sound effects */
+void audio_make_sounds() {
+	for (int i = 0; i < WAVE_LENGTH; i++) {
+		wave_square[i] = i < WAVE_LENGTH / 2 ? 127 : -127;
+		int rise = i < WAVE_LENGTH / 2 ? i : WAVE_LENGTH - i;
+		wave_triangle[i] = rise * 254 / (WAVE_LENGTH / 2) - 127;
+	}
+	sound_make(sound_laser, SOUND_LASER_LENGTH, 2000, 400, 0);
+	sound_make(sound_hit, SOUND_HIT_LENGTH, 0, 0, 1);
+	sound_make(sound_death, SOUND_DEATH_LENGTH, 700, 60, 0);
+}
+
+/* the tune, a note for each step as semitones above C2, looped forever */
+#define NOTE_REST 255
+#define MUSIC_STEPS 32
+#define MUSIC_STEP_FRAMES 8
+
+const unsigned char music_melody[MUSIC_STEPS] = {
+	28, 31, 33, 31, 28, 26, 24, NOTE_REST,
+	26, 28, 31, 28, 26, 24, 26, NOTE_REST,
+	28, 31, 33, 36, 35, 33, 31, NOTE_REST,
+	33, 31, 28, 26, 24, 26, 24, NOTE_REST,
+};
+
+const unsigned char music_bass[MUSIC_STEPS] = {
+	12, NOTE_REST, 19, NOTE_REST, 12, NOTE_REST, 19, NOTE_REST,
+	7, NOTE_REST, 14, NOTE_REST, 7, NOTE_REST, 14, NOTE_REST,
+	9, NOTE_REST, 16, NOTE_REST, 9, NOTE_REST, 16, NOTE_REST,
+	5, NOTE_REST, 12, NOTE_REST, 12, NOTE_REST, 7, NOTE_REST,
+};
+
+/* the step through a wave for each note of the lowest octave, C2 to B2 -
+ * each octave up doubles it */
+const unsigned short note_steps[12] = {
+	472, 500, 530, 561, 595, 630, 668, 707, 749, 794, 841, 891
+};
+
+int music_playing = 0;
+int music_step = 0;
+int music_timer = 0;
+
+/* start a note on a music voice, or let it go quiet for a rest */
+void music_note(struct Voice* voice, const signed char* wave, int note, int volume) {
+	if (note == NOTE_REST) {
+		voice->volume = 0;
+		return;
+	}
+	voice->data = wave;
+	voice->step = note_steps[note % 12] << (note / 12);
+	voice->end = WAVE_LENGTH << AUDIO_FRACTION;
+	voice->loop = 1;
+	voice->volume = volume;
+}
+
+/* start the music from the top, or stop it */
+void audio_music(int playing) {
+	music_playing = playing;
+	music_step = 0;
+	music_timer = 0;
+	for (int i = 0; i < AUDIO_MUSIC_VOICES; i++) {
+		voices[i].volume = 0;
+	}
+}
+
+/* move the tune on a frame, the melody dies away a little each frame */
+void music_update() {
+	if (!music_playing) {
+		return;
+	}
+	if (music_timer == 0) {
+		music_note(&voices[0], wave_square, music_melody[music_step], 20);
+		music_note(&voices[1], wave_triangle, music_bass[music_step], 32);
+		music_step = (music_step + 1) % MUSIC_STEPS;
+		music_timer = MUSIC_STEP_FRAMES;
+	}
+	music_timer--;
+	if (voices[0].volume > 8) {
+		voices[0].volume--;
+	}
+}
+
+/* play a sound effect on a free voice, or on the one nearest its end */
+void audio_play(int sound) {
+	struct Voice* voice = &voices[AUDIO_MUSIC_VOICES];
+	for (int i = AUDIO_MUSIC_VOICES; i < AUDIO_VOICES; i++) {
+		if (voices[i].end == 0) {
+			voice = &voices[i];
+			break;
+		}
+		if (voices[i].position > voice->position) {
+			voice = &voices[i];
+		}
+	}
+	voice->data = sounds[sound].data;
+	voice->position = 0;
+	voice->step = 1 << AUDIO_FRACTION;
+	voice->end = sounds[sound].length << AUDIO_FRACTION;
+	voice->loop = 0;
+	voice->volume = 48;
+}
+
+/* add a voice into the mix for count samples, a multiple of 4 */
+IWRAM_CODE void audio_mix_voice(struct Voice* voice, int* mix, int count) {
+	const signed char* data = voice->data;
+	unsigned int position = voice->position;
+	unsigned int step = voice->step;
+	int volume = voice->volume;
+
+	if (voice->loop) {
+		/* the position just wraps round the end */
+		unsigned int mask = voice->end - 1;
+		for (int i = 0; i < count; i += 4) {
+			mix[i] += data[position >> AUDIO_FRACTION] * volume;
+			position = (position + step) & mask;
+			mix[i + 1] += data[position >> AUDIO_FRACTION] * volume;
+			position = (position + step) & mask;
+			mix[i + 2] += data[position >> AUDIO_FRACTION] * volume;
+			position = (position + step) & mask;
+			mix[i + 3] += data[position >> AUDIO_FRACTION] * volume;
+			position = (position + step) & mask;
+		}
+	} else if (position + step * count < voice->end) {
+		/* it doesn't reach the end this frame, so there's nothing to check */
+		for (int i = 0; i < count; i += 4) {
+			mix[i] += data[position >> AUDIO_FRACTION] * volume;
+			position += step;
+			mix[i + 1] += data[position >> AUDIO_FRACTION] * volume;
+			position += step;
+			mix[i + 2] += data[position >> AUDIO_FRACTION] * volume;
+			position += step;
+			mix[i + 3] += data[position >> AUDIO_FRACTION] * volume;
+			position += step;
+		}
+	} else {
+		/* the last frame of it */
+		for (int i = 0; i < count && position < voice->end; i++) {
+			mix[i] += data[position >> AUDIO_FRACTION] * volume;
+			position += step;
+		}
+		voice->end = 0;
+	}
+	voice->position = position;
+}
+
+/* mix some voices into a buffer of 8 bit samples, four to a word */
+IWRAM_CODE void audio_mix_voices(struct Voice* first, int count, signed char* buffer) {
+	int* mix = audio_mix_buffer;
+	for (int i = 0; i < AUDIO_SAMPLES; i++) {
+		mix[i] = 0;
+	}
+	for (int v = 0; v < count; v++) {
+		if (first[v].end != 0 && first[v].volume != 0) {
+			audio_mix_voice(&first[v], mix, AUDIO_SAMPLES);
+		}
+	}
+
+	/* the volume is out of 64, then clip anything too loud */
+	unsigned int* words = (unsigned int*) buffer;
+	for (int i = 0; i < AUDIO_SAMPLES; i += 4) {
+		unsigned int word = 0;
+		for (int j = 0; j < 4; j++) {
+			int sample = mix[i + j] >> 6;
+			if (sample > 127) {
+				sample = 127;
+			} else if (sample < -128) {
+				sample = -128;
+			}
+			word |= (sample & 0xff) << (j * 8);
+		}
+		words[i / 4] = word;
+	}
+}
+
+/* turn the sound on and start the timer which sets the rate, the DMA
+ * starts at the next vblank */
+void audio_init() {
+	audio_make_sounds();
+	for (int i = 0; i < AUDIO_VOICES; i++) {
+		voices[i].end = 0;
+		voices[i].volume = 0;
+	}
+	for (int i = 0; i < AUDIO_SAMPLES; i++) {
+		audio_music_buffers[0][i] = audio_music_buffers[1][i] = 0;
+		audio_effect_buffers[0][i] = audio_effect_buffers[1][i] = 0;
+	}
+
+	/* the master switch has to go on before the other registers work */
+	*sound_status = 0x80;
+	*sound_control = (1 << 2) |  /* FIFO A at full volume */
+		(1 << 3) |               /* FIFO B at full volume */
+		(3 << 8) |               /* A to both speakers, timed by timer 0 */
+		(1 << 11) |              /* empty FIFO A */
+		(3 << 12) |              /* B to both speakers, timed by timer 0 */
+		(1 << 15);               /* empty FIFO B */
+
+	*timer0_reload = 0x10000 - AUDIO_PERIOD;
+	*timer0_control = 0x80;
+	audio_playing = 0;
+	audio_mixed = 0;
+	audio_running = 1;
+}
+
+/* called from the vblank interrupt: a buffer is exactly a frame long, so the
+ * one mixed last frame starts now, wherever the game is up to - if it missed
+ * the mix, the last one plays again */
+void audio_vblank() {
+	if (!audio_running) {
+		return;
+	}
+	audio_playing = !audio_playing;
+	audio_mixed = 0;
+
+	dma_stop(AUDIO_MUSIC_CHANNEL);
+	dma_stop(AUDIO_EFFECT_CHANNEL);
+	dma_start(AUDIO_MUSIC_CHANNEL, audio_music_buffers[audio_playing], fifo_a,
+			DMA_ENABLE | DMA_SOUND | DMA_REPEAT | DMA_DEST_FIXED | DMA_32 | 4);
+	dma_start(AUDIO_EFFECT_CHANNEL, audio_effect_buffers[audio_playing], fifo_b,
+			DMA_ENABLE | DMA_SOUND | DMA_REPEAT | DMA_DEST_FIXED | DMA_32 | 4);
+}
+
+/* mix the buffers which play next frame, once a frame */
+void audio_mix() {
+	if (!audio_running || audio_mixed) {
+		return;
+	}
+	music_update();
+	audio_mix_voices(&voices[0], AUDIO_MUSIC_VOICES, audio_music_buffers[!audio_playing]);
+	audio_mix_voices(&voices[AUDIO_MUSIC_VOICES], AUDIO_VOICES - AUDIO_MUSIC_VOICES,
+			audio_effect_buffers[!audio_playing]);
+	audio_mixed = 1;
+}
+
+/* a sprite is a moveable image on the screen */
+struct Sprite {
+	unsigned short attribute0;
+	unsigned short attribute1;
+	unsigned short attribute2;
+	unsigned short attribute3;
+};
+
+/* the game can have more sprites than the GBA, they share the 128 in OAM */
+#define MAX_SPRITES 256
+
+/* all of the game's sprites, and which are in use */
+struct Sprite sprites[MAX_SPRITES];
+unsigned char sprite_live[MAX_SPRITES];
+
+/* the sprites which are free, as a stack */
+unsigned short sprite_free_list[MAX_SPRITES];
+int sprite_free_count = 0;
+
+/* the sprites in use, in the order they were sorted into last time; freed
+ * ones are only taken out when it's next sorted, and one given out again
+ * before then is still in it, so sprite_ordered says which are in it */
+unsigned short sprite_order[MAX_SPRITES];
+unsigned char sprite_ordered[MAX_SPRITES];
+int sprite_order_count = 0;
+int sprite_order_stale = 0;
+
+/* whether the sprites need sorting into OAM again, because one came, went,
+ * or moved up or down or on or off the screen */
+int sprites_changed = 0;
+
+/* which OAM entry each sprite was put in last time, or -1 if it isn't in
+ * one, so a change which doesn't move it in the order can go straight there */
+short sprite_entry[MAX_SPRITES];
+
+/* which frame of the sprite sheet each sprite shows, as a tile offset into
+ * the sheet, and which tile cache slot holds it, or -1 */
+short sprite_frame[MAX_SPRITES];
+signed char sprite_slot[MAX_SPRITES];
+
+/* a copy of what is in OAM, and one bit for each entry which has changed
+ * since it was last copied over */
+struct Sprite oam_shadow[NUM_SPRITES];
+unsigned int oam_dirty[NUM_SPRITES / 32];
+
+/* how many sprites were on the screen last update, and how many of them
+ * didn't fit - those take turns with the rest from frame to frame */
+unsigned int sprites_visible = 0;
+unsigned int sprites_dropped = 0;
+unsigned int sprite_rotation = 0;
+
+/* how much of OAM the last sprite_update_all copied, in bytes and in runs of
+ * neighbouring sprites */
+unsigned int sprite_bytes_copied = 0;
+unsigned int sprite_spans_copied = 0;
+
+/* the width and height of each sprite shape and size, in pixels */
+const unsigned char sprite_widths[3][4] = {{8, 16, 32, 64}, {16, 32, 32, 64}, {8, 8, 16, 32}};
+const unsigned char sprite_heights[3][4] = {{8, 16, 32, 64}, {8, 8, 16, 32}, {16, 32, 32, 64}};
+
+/* sprite image memory is split into slots, each big enough for one 32x32
+ * frame; 256 color tiles are 64 bytes, but sprite tile numbers count in
+ * 32 byte units, so a slot is 32 of those */
+#define TILE_SLOT_UNITS 32
+#define TILE_SLOT_BYTES (TILE_SLOT_UNITS * 32)
+#define TILE_SLOTS (0x8000 / TILE_SLOT_BYTES)
+
+/* the sprite sheet stays in ROM and only the frames being shown are copied
+ * into sprite image memory. a frame bigger than a slot takes a run of them,
+ * counted from the first one, the head */
+struct TileSlot {
+	/* the frame the slot holds, as a tile offset into the sheet, or -1 */
+	short frame;
+
+	/* the slot at the start of the run this one is part of */
+	unsigned char head;
+
+	/* in the head slot only: how many slots the run is, how many sprites
+	 * are showing it, and when it was last asked for */
+	unsigned char length;
+	unsigned short refs;
+	unsigned int last_used;
+};
+
+struct TileSlot tile_slots[TILE_SLOTS];
+unsigned int tile_clock = 0;
+
+/* how often a frame was already loaded, how often it had to be loaded, and
+ * how many bytes of sprite image have been copied since the game started */
+unsigned int tile_cache_hits = 0;
+unsigned int tile_cache_misses = 0;
+unsigned int tile_bytes_uploaded = 0;
+
+/* forget everything in the cache */
+void tile_cache_reset() {
+	for (int i = 0; i < TILE_SLOTS; i++) {
+		tile_slots[i].frame = -1;
+		tile_slots[i].head = i;
+		tile_slots[i].length = 1;
+		tile_slots[i].refs = 0;
+		tile_slots[i].last_used = 0;
+	}
+	tile_clock = 0;
+}
+
+/* empty every slot of the run a slot belongs to */
+void tile_cache_evict(int slot) {
+	int head = tile_slots[slot].head;
+	int length = tile_slots[head].length;
+	for (int i = head; i < head + length; i++) {
+		tile_slots[i].frame = -1;
+		tile_slots[i].head = i;
+		tile_slots[i].length = 1;
+		tile_slots[i].refs = 0;
+		tile_slots[i].last_used = 0;
+	}
+}
+
+/* get a frame of the sheet into sprite image memory, returning the tile
+ * number to show it with, or -1 if every slot is in use or the DMA queue is
+ * full. the copy is queued and goes out in the next vblank */
+int tile_cache_acquire(int frame, int units) {
+	int length = (units + TILE_SLOT_UNITS - 1) / TILE_SLOT_UNITS;
+	tile_clock++;
+
+	/* is it already there? */
+	for (int i = 0; i < TILE_SLOTS; i += tile_slots[i].length) {
+		if (tile_slots[i].frame == frame && tile_slots[i].length == length) {
+			tile_slots[i].refs++;
+			tile_slots[i].last_used = tile_clock;
+			tile_cache_hits++;
+			return i * TILE_SLOT_UNITS;
+		}
+	}
+	tile_cache_misses++;
+
+	/* find the run of slots which nothing is showing and which was used
+	 * longest ago - empty slots count as never used */
+	int best = -1;
+	unsigned int best_age = 0xffffffff;
+	for (int start = 0; start + length <= TILE_SLOTS; start++) {
+		unsigned int age = 0;
+		int i;
+		for (i = start; i < start + length; i++) {
+			struct TileSlot* head = &tile_slots[tile_slots[i].head];
+			if (head->refs) {
+				break;
+			}
+			if (head->last_used > age) {
+				age = head->last_used;
+			}
+		}
+		if (i == start + length && age < best_age) {
+			best = start;
+			best_age = age;
+		}
+	}
+	if (best < 0) {
+		return -1;
+	}
+
+	/* clear out whatever was there, and claim the run */
+	for (int i = best; i < best + length; i++) {
+		if (tile_slots[i].frame >= 0) {
+			tile_cache_evict(i);
+		}
+	}
+	for (int i = best; i < best + length; i++) {
+		tile_slots[i].frame = frame;
+		tile_slots[i].head = best;
+	}
+	tile_slots[best].length = length;
+	tile_slots[best].refs = 1;
+	tile_slots[best].last_used = tile_clock;
+
+	/* copy what the sheet has of the frame - the sheet isn't packed, as
+	 * any frame of it can be wanted at any time */
+	unsigned int sheet_bytes = spritesheet_width * spritesheet_height;
+	unsigned int offset = frame * 32;
+	unsigned int bytes = units * 32;
+	if (offset >= sheet_bytes) {
+		bytes = 0;
+	} else if (offset + bytes > sheet_bytes) {
+		bytes = sheet_bytes - offset;
+	}
+	if (bytes) {
+		/* if the copy can't be queued the slots would show whatever was
+		 * there before, so give them back and let the caller try again */
+		if (!dma_queue(sprite_image_memory + best * TILE_SLOT_BYTES / 2,
+				(const unsigned char*) spritesheet_data + offset, bytes)) {
+			tile_cache_evict(best);
+			return -1;
+		}
+		tile_bytes_uploaded += bytes;
+	}
+	return best * TILE_SLOT_UNITS;
+}
+
+/* a sprite has stopped showing the frame in a slot - it stays loaded in
+ * case it is wanted again, until the slot is needed for something else */
+void tile_cache_release(int slot) {
+	if (tile_slots[slot].refs) {
+		tile_slots[slot].refs--;
+	}
+}
+
+/* the different sizes of sprites which are possible */
+enum SpriteSize {
+	SIZE_8_8,
+	SIZE_16_16,
+	SIZE_32_32,
+	SIZE_64_64,
+	SIZE_16_8,
+	SIZE_32_8,
+	SIZE_32_16,
+	SIZE_64_32,
+	SIZE_8_16,
+	SIZE_8_32,
+	SIZE_16_32,
+	SIZE_32_64
+};
+
+IWRAM_CODE void sprite_set_offset(struct Sprite* sprite, int offset);
+
+/* function to initialize a sprite with its properties, and return a pointer */
+struct Sprite* sprite_init(int x, int y, enum SpriteSize size, int horizontal_flip, int vertical_flip, int tile_index, int priority) {
+
+	/* setup the bits used for each shape/size possible, there's no sprite
+	 * for any other size */
+	int size_bits, shape_bits;
+	switch (size) {
+		case SIZE_8_8:   size_bits = 0; shape_bits = 0; break;
+		case SIZE_16_16: size_bits = 1; shape_bits = 0; break;
+		case SIZE_32_32: size_bits = 2; shape_bits = 0; break;
+		case SIZE_64_64: size_bits = 3; shape_bits = 0; break;
+		case SIZE_16_8:  size_bits = 0; shape_bits = 1; break;
+		case SIZE_32_8:  size_bits = 1; shape_bits = 1; break;
+		case SIZE_32_16: size_bits = 2; shape_bits = 1; break;
+		case SIZE_64_32: size_bits = 3; shape_bits = 1; break;
+		case SIZE_8_16:  size_bits = 0; shape_bits = 2; break;
+		case SIZE_8_32:  size_bits = 1; shape_bits = 2; break;
+		case SIZE_16_32: size_bits = 2; shape_bits = 2; break;
+		case SIZE_32_64: size_bits = 3; shape_bits = 2; break;
+		default: return 0;
+	}
+
+	/* grab a free sprite, if there are any left */
+	if (sprite_free_count == 0) {
+		return 0;
+	}
+	int index = sprite_free_list[--sprite_free_count];
+	sprite_live[index] = 1;
+	sprite_entry[index] = -1;
+	if (!sprite_ordered[index]) {
+		sprite_ordered[index] = 1;
+		sprite_order[sprite_order_count++] = index;
+	}
+
+	int h = horizontal_flip ? 1 : 0;
+	int v = vertical_flip ? 1 : 0;
+
+	/* set up the first attribute */
+	sprites[index].attribute0 = y |             /* y coordinate */
+							(0 << 8) |          /* rendering mode */
+							(0 << 10) |         /* gfx mode */
+							(0 << 12) |         /* mosaic */
+							(1 << 13) |         /* color mode, 0:16, 1:256 */
+							(shape_bits << 14); /* shape */
+
+	/* set up the second attribute */
+	sprites[index].attribute1 = x |             /* x coordinate */
+							(0 << 9) |          /* affine flag */
+							(h << 12) |         /* horizontal flip flag */
+							(v << 13) |         /* vertical flip flag */
+							(size_bits << 14);  /* size */
+
+	/* setup the second attribute, the tile comes from the tile cache */
+	sprites[index].attribute2 = 0 |            // tile index */
+							(priority << 10) | // priority */
+							(0 << 12);         // palette bank (only 16 color)*/
+
+	/* a new sprite has to be sorted in */
+	sprites_changed = 1;
+
+	/* show the frame of the sheet it starts on */
+	sprite_frame[index] = -1;
+	sprite_slot[index] = -1;
+	sprite_set_offset(&sprites[index], tile_index);
+
+	/* return pointer to this sprite */
+	return &sprites[index];
+}
+
+/* give a sprite back, it comes off the screen at the next update */
+void sprite_free(struct Sprite* sprite) {
+	int index = sprite - sprites;
+	if (!sprite_live[index]) {
+		return;
+	}
+	sprite_live[index] = 0;
+	sprite_entry[index] = -1;
+	sprite_free_list[sprite_free_count++] = index;
+	if (sprite_slot[index] >= 0) {
+		tile_cache_release(sprite_slot[index]);
+		sprite_slot[index] = -1;
+	}
+	sprite_order_stale = 1;
+	sprites_changed = 1;
+}
+
+/* whether any of a sprite is on the screen - the coordinates wrap, so one
+ * near the bottom or right edge of the range pokes in from the other side */
+int sprite_visible(const struct Sprite* sprite) {
+	int shape = (sprite->attribute0 >> 14) & 3;
+	int size = sprite->attribute1 >> 14;
+	if (shape == 3) {
+		return 0;
+	}
+	int y = sprite->attribute0 & 0xff;
+	int x = sprite->attribute1 & 0x1ff;
+	return (y < SCREEN_HEIGHT || y + sprite_heights[shape][size] > 256) &&
+		(x < SCREEN_WIDTH || x + sprite_widths[shape][size] > 512);
+}
+
+/* what the sprites are sorted on: priority first, then y from the top of
+ * the screen, counting ones poking in from above as negative */
+static inline int sprite_sort_key(const struct Sprite* sprite) {
+	int y = sprite->attribute0 & 0xff;
+	if (y >= SCREEN_HEIGHT) {
+		y -= 256;
+	}
+	return ((sprite->attribute2 >> 10) & 3) * 512 + y;
+}
+
+/* put one sprite into an OAM entry, noting it if it changed */
+static inline void oam_set(int slot, const struct Sprite* sprite) {
+	struct Sprite* entry = &oam_shadow[slot];
+	if (entry->attribute0 != sprite->attribute0 || entry->attribute1 != sprite->attribute1 ||
+			entry->attribute2 != sprite->attribute2) {
+		entry->attribute0 = sprite->attribute0;
+		entry->attribute1 = sprite->attribute1;
+		entry->attribute2 = sprite->attribute2;
+		oam_dirty[slot >> 5] |= 1u << (slot & 31);
+	}
+}
+
+/* a sprite's flip or frame changed, which doesn't move it in the order, so
+ * just its own entry needs updating - if it doesn't have one it's off the
+ * screen, or a sort is coming which will put it in one */
+static inline void sprite_mark_dirty(struct Sprite* sprite) {
+	int entry = sprite_entry[sprite - sprites];
+	if (entry >= 0) {
+		oam_set(entry, sprite);
+	}
+}
+
+/* build what OAM should hold from the game's sprites: leave out the ones
+ * which are off the screen, sort the rest, and if there are still too many,
+ * show a different 128 each frame so they all flicker rather than some
+ * vanishing for good */
+void sprite_build_oam() {
+	/* take out the sprites which were freed */
+	if (sprite_order_stale) {
+		int kept = 0;
+		for (int i = 0; i < sprite_order_count; i++) {
+			if (sprite_live[sprite_order[i]]) {
+				sprite_order[kept++] = sprite_order[i];
+			} else {
+				sprite_ordered[sprite_order[i]] = 0;
+			}
+		}
+		sprite_order_count = kept;
+		sprite_order_stale = 0;
+	}
+	for (int i = 0; i < sprite_order_count; i++) {
+		sprite_entry[sprite_order[i]] = -1;
+	}
+
+	/* the order hardly changes between frames, so insertion sort is quick */
+	static short keys[MAX_SPRITES];
+	for (int i = 0; i < sprite_order_count; i++) {
+		keys[i] = sprite_sort_key(&sprites[sprite_order[i]]);
+	}
+	for (int i = 1; i < sprite_order_count; i++) {
+		unsigned short index = sprite_order[i];
+		short key = keys[i];
+		int j = i - 1;
+		while (j >= 0 && keys[j] > key) {
+			sprite_order[j + 1] = sprite_order[j];
+			keys[j + 1] = keys[j];
+			j--;
+		}
+		sprite_order[j + 1] = index;
+		keys[j + 1] = key;
+	}
+
+	/* only the ones on the screen need an OAM entry */
+	static unsigned short visible[MAX_SPRITES];
+	int count = 0;
+	for (int i = 0; i < sprite_order_count; i++) {
+		if (sprite_visible(&sprites[sprite_order[i]])) {
+			visible[count++] = sprite_order[i];
+		}
+	}
+	sprites_visible = count;
+
+	/* when there are too many, show the 128 starting from a point which
+	 * moves along each frame, keeping them in sorted order */
+	int first = 0, shown = count;
+	if (count > NUM_SPRITES) {
+		sprites_dropped = count - NUM_SPRITES;
+		sprite_rotation = (sprite_rotation + sprites_dropped) % count;
+		first = sprite_rotation;
+		shown = NUM_SPRITES;
+	} else {
+		sprites_dropped = 0;
+		sprite_rotation = 0;
+	}
+
+	/* the ones which wrapped round to the start of the list go first */
+	int slot = 0;
+	int wrapped = first + shown - count;
+	for (int i = 0; i < wrapped; i++) {
+		sprite_entry[visible[i]] = slot;
+		oam_set(slot++, &sprites[visible[i]]);
+	}
+	for (int i = first; i < first + shown && i < count; i++) {
+		sprite_entry[visible[i]] = slot;
+		oam_set(slot++, &sprites[visible[i]]);
+	}
+
+	/* and the rest of OAM is hidden */
+	static const struct Sprite hidden = {SCREEN_HEIGHT, SCREEN_WIDTH, 0, 0};
+	while (slot < NUM_SPRITES) {
+		oam_set(slot++, &hidden);
+	}
+}
+
+/* update all of the spries on the screen */
+void sprite_update_all() {
+	sprite_bytes_copied = 0;
+	sprite_spans_copied = 0;
+
+	/* nothing to do unless something changed, or they are taking turns */
+	if (sprites_changed || sprites_dropped) {
+		sprites_changed = 0;
+		sprite_build_oam();
+	}
+
+	/* copy over each run of changed OAM entries */
+	for (int word = 0; word < NUM_SPRITES / 32; word++) {
+		unsigned int bits = oam_dirty[word];
+		oam_dirty[word] = 0;
+
+		while (bits) {
+			/* find where this run starts and how long it goes on for */
+			int first = __builtin_ctz(bits);
+			int count = (~bits >> first) ? __builtin_ctz(~bits >> first) : 32 - first;
+			if (first + count >= 32) {
+				count = 32 - first;
+				bits = 0;
+			} else {
+				bits &= ~(((1u << count) - 1) << first);
+			}
+
+			int index = word * 32 + first;
+			memcpy16_dma((unsigned short*) sprite_attribute_memory + index * 4,
+					(unsigned short*) &oam_shadow[index], count * 4);
+			sprite_bytes_copied += count * sizeof(struct Sprite);
+			sprite_spans_copied++;
+		}
+	}
+}
+
+/* setup all sprites */
+void sprite_clear() {
+	/* every sprite is free again */
+	for (int i = 0; i < MAX_SPRITES; i++) {
+		sprite_live[i] = 0;
+		sprite_ordered[i] = 0;
+		sprite_entry[i] = -1;
+		sprite_free_list[i] = MAX_SPRITES - 1 - i;
+	}
+	sprite_free_count = MAX_SPRITES;
+	sprite_order_count = 0;
+	tile_cache_reset();
+	sprite_order_stale = 0;
+	sprites_dropped = 0;
+	sprite_rotation = 0;
+
+	/* move all OAM entries offscreen to hide them */
+	for(int i = 0; i < NUM_SPRITES; i++) {
+		oam_shadow[i].attribute0 = SCREEN_HEIGHT;
+		oam_shadow[i].attribute1 = SCREEN_WIDTH;
+		oam_shadow[i].attribute2 = 0;
+	}
+
+	/* and send them all next time */
+	for (int i = 0; i < NUM_SPRITES / 32; i++) {
+		oam_dirty[i] = 0xffffffff;
+	}
+	sprites_changed = 1;
+}
+
+/* set a sprite postion */
+IWRAM_CODE void sprite_position(struct Sprite* sprite, int x, int y) {
+	/* clear out the y coordinate and set the new one */
+	unsigned short attribute0 = (sprite->attribute0 & 0xff00) | (y & 0xff);
+
+	/* clear out the x coordinate and set the new one */
+	unsigned short attribute1 = (sprite->attribute1 & 0xfe00) | (x & 0x1ff);
+
+	/* most sprites sit still most frames, only send ones which moved */
+	if (attribute0 != sprite->attribute0 || attribute1 != sprite->attribute1) {
+		/* going up or down changes the order, and going on or off the
+		 * screen changes which get an entry, either needs a sort - going
+		 * across and staying on the screen only needs its own entry */
+		int visible = sprite_visible(sprite);
+		int moved = attribute0 != sprite->attribute0;
+		sprite->attribute0 = attribute0;
+		sprite->attribute1 = attribute1;
+		if (moved || visible != sprite_visible(sprite)) {
+			sprites_changed = 1;
+		} else {
+			sprite_mark_dirty(sprite);
+		}
+	}
+}
+
+/* move a sprite in a direction */
+IWRAM_CODE void sprite_move(struct Sprite* sprite, int dx, int dy) {
+	/* get the current y coordinate */
+	int y = sprite->attribute0 & 0xff;
+
+	/* get the current x coordinate */
+	int x = sprite->attribute1 & 0x1ff;
+
+	/* move to the new location */
+	sprite_position(sprite, x + dx, y + dy);
+}
+
+/* change the vertical flip flag */
+IWRAM_CODE void sprite_set_vertical_flip(struct Sprite* sprite, int vertical_flip) {
+	unsigned short attribute1;
+	if (vertical_flip) {
+		/* set the bit */
+		attribute1 = sprite->attribute1 | 0x2000;
+	} else {
+		/* clear the bit */
+		attribute1 = sprite->attribute1 & 0xdfff;
+	}
+	if (attribute1 != sprite->attribute1) {
+		sprite->attribute1 = attribute1;
+		sprite_mark_dirty(sprite);
+	}
+}
+
+/* change the vertical flip flag */
+IWRAM_CODE void sprite_set_horizontal_flip(struct Sprite* sprite, int horizontal_flip) {
+	unsigned short attribute1;
+	if (horizontal_flip) {
+		/* set the bit */
+		attribute1 = sprite->attribute1 | 0x1000;
+	} else {
+		/* clear the bit */
+		attribute1 = sprite->attribute1 & 0xefff;
+	}
+	if (attribute1 != sprite->attribute1) {
+		sprite->attribute1 = attribute1;
+		sprite_mark_dirty(sprite);
+	}
+}
+
+/* change which frame of the sprite sheet a sprite shows, given as the tile
+ * offset into the sheet - the frame is loaded through the tile cache */
+IWRAM_CODE void sprite_set_offset(struct Sprite* sprite, int offset) {
+	int index = sprite - sprites;
+	if (sprite_frame[index] == offset) {
+		return;
+	}
+
+	/* how many 32 byte tile units a frame this size takes */
+	int shape = (sprite->attribute0 >> 14) & 3;
+	int size = sprite->attribute1 >> 14;
+	int units = sprite_widths[shape][size] * sprite_heights[shape][size] / 32;
+
+	/* get the new frame before letting go of the old one, and keep showing
+	 * the old one if there's no room */
+	int tile = tile_cache_acquire(offset, units);
+	if (tile < 0) {
+		return;
+	}
+	if (sprite_slot[index] >= 0) {
+		tile_cache_release(sprite_slot[index]);
+	}
+	sprite_slot[index] = tile / TILE_SLOT_UNITS;
+	sprite_frame[index] = offset;
+
+	/* clear the old tile and apply the new one */
+	unsigned short attribute2 = (sprite->attribute2 & 0xfc00) | (tile & 0x03ff);
+
+	if (attribute2 != sprite->attribute2) {
+		sprite->attribute2 = attribute2;
+		sprite_mark_dirty(sprite);
+	}
+}
+
+/* setup the sprite image and palette */
+void setup_sprite_image() {
+	/* load the palette from the image into palette memory*/
+	dma_queue(sprite_palette, spritesheet_palette, PALETTE_SIZE * 2);
+
+	/* the image itself is loaded a frame at a time by the tile cache */
+}
+
+/* a struct for Falco's logic and behavior */
+struct Falco {
+	/* the actual sprite attribute info */
+	struct Sprite* sprite;
+
+	/* the x and y postion, in 1/256 pixels */
+	int x, y;
+
+	/* the falco's y velocity in 1/256 pixels/second */
+	int yvel;
+
+	/* the falco's y acceleration in 1/256 pixels/second^2 */
+	int gravity; 
+
+	/* which frame of the animation he is on */
+	int frame;
+
+	/* the number of frames to wait before flipping */
+	int animation_delay;
+
+	/* the animation counter counts how many frames until we flip */
+	int counter;
+
+	/* whether the falco is moving right now or not */
+	int move;
+
+	/* the number of pixels away from the edge of the screen the falco stays */
+	int border;
+
+	/* if the falco is currently falling */
+	int falling;
+
+	//if falco is facing left = 0, right = 1
+	int facing;
+
+	//Score of how many times he shot a shyguy
+	int score;
+
+	/* if he is touching a hazard tile */
+	int hurt;
+};
+
+/* the most shyguys there can be at once, each one keeps a sprite */
+#define MAX_SHYGUYS 32
+
+/* the number of frames to wait before flipping a shyguy's animation */
+#define SHYGUY_ANIMATION_DELAY 8
+
+/* the y a shyguy starts from, in pixels, it falls to the ground from there */
+#define SHYGUY_START_Y 113
+
+/* all of the shyguys, with one array for each field rather than an array of
+ * structs, so each system is one tight loop over just the fields it needs.
+ * the live ones are always the first count entries: spawning adds one on the
+ * end and despawning moves the last one into the gap */
+struct Shyguys {
+	int count;
+
+	/* the x and y position in the world, and where to go back to when shot,
+	 * in 1/256 pixels */
+	int x[MAX_SHYGUYS];
+	int y[MAX_SHYGUYS];
+	int origx[MAX_SHYGUYS];
+
+	/* how fast they walk towards the falco, in 1/256 pixels/frame */
+	int xvel[MAX_SHYGUYS];
+
+	/* the y velocity in 1/256 pixels/frame, and whether each is in the air */
+	int yvel[MAX_SHYGUYS];
+	unsigned char falling[MAX_SHYGUYS];
+
+	/* the x each one is heading for, in world pixels */
+	int goal[MAX_SHYGUYS];
+
+	/* the animation frame (a tile offset), and frames until it flips */
+	short frame[MAX_SHYGUYS];
+	unsigned char counter[MAX_SHYGUYS];
+
+	/* whether each one is walking right now */
+	unsigned char move[MAX_SHYGUYS];
+
+	/* each live one has a sprite, which goes along with it when it moves */
+	struct Sprite* sprite[MAX_SHYGUYS];
+};
+
+/* the most lasers which can be flying at once */
+#define MAX_LASERS 16
+
+/* all of the lasers, laid out like the shyguys: the first count are flying
+ * and the rest are free, so firing takes the first free one and retiring
+ * moves the last flying one into the gap */
+struct Lasers {
+	int count;
+
+	/* the x and y position, in 1/256 pixels */
+	int x[MAX_LASERS];
+	int y[MAX_LASERS];
+
+	/* how far each one goes per frame, in 1/256 pixels, and how many frames
+	 * it has left before it fizzles out */
+	int xvel[MAX_LASERS];
+	unsigned char life[MAX_LASERS];
+
+	/* each flying one has a sprite, which goes along with it when it moves */
+	struct Sprite* sprite[MAX_LASERS];
+
+	/* frames until the falco can fire again */
+	int cooldown;
+};
+
+/* the score goes in the top right of the HUD */
+#define SCORE_COLUMN 20
+#define SCORE_ROW 0
+#define SCORE_DIGITS 4
+
+struct Score {
+	/* the score the HUD is showing */
+	int shown;
+};
+
+void score_init(struct Score* score){
+	score->shown = -1;
+	hud_print(SCORE_COLUMN, SCORE_ROW, "SCORE");
+}
+
+/* initialize the falco */
+void falco_init(struct Falco* falco) {
+	falco->x = 100 << 8;
+	falco->y = 113 << 8;
+	falco->yvel = 0;
+	falco->gravity = 50;
+	falco->border = 40;
+	falco->frame = 112;
+	falco->move = 0;
+	falco->counter = 0;
+	falco->falling = 0;
+	falco->animation_delay = 8;
+	falco->facing = 1;
+	falco->score = 0;
+	falco->hurt = 0;
+	falco->sprite = sprite_init(falco->x >> 8, falco->y >> 8, SIZE_32_32, 0, 0, 112, 0);
+}
+
+/* empty the shyguy pool */
+void shyguys_init(struct Shyguys* shyguys) {
+	shyguys->count = 0;
+}
+
+/* put a shyguy back where it started, to fall to the ground */
+void shyguy_restart(struct Shyguys* shyguys, int i) {
+	shyguys->x[i] = shyguys->origx[i];
+	shyguys->y[i] = SHYGUY_START_Y << 8;
+	shyguys->yvel[i] = 0;
+	shyguys->falling[i] = 1;
+	shyguys->goal[i] = shyguys->origx[i] >> 8;
+}
+
+/* add a shyguy at an x coordinate in the world, returns its index or -1 if
+ * full */
+int shyguy_spawn(struct Shyguys* shyguys, int xcoordinate) {
+	if (shyguys->count == MAX_SHYGUYS) {
+		return -1;
+	}
+	struct Sprite* sprite = sprite_init(xcoordinate, SHYGUY_START_Y, SIZE_32_32, 0, 0, 0, 0);
+	if (!sprite) {
+		return -1;
+	}
+	int i = shyguys->count++;
+	shyguys->sprite[i] = sprite;
+	shyguys->origx[i] = xcoordinate << 8;
+	shyguys->xvel[i] = 128;
+	shyguys->frame[i] = 0;
+	shyguys->counter[i] = 0;
+	shyguys->move[i] = 1;
+	shyguy_restart(shyguys, i);
+	return i;
+}
+
+/* remove a shyguy by moving the last one into its place */
+void shyguy_despawn(struct Shyguys* shyguys, int i) {
+	int last = --shyguys->count;
+	sprite_free(shyguys->sprite[i]);
+
+	shyguys->x[i] = shyguys->x[last];
+	shyguys->y[i] = shyguys->y[last];
+	shyguys->origx[i] = shyguys->origx[last];
+	shyguys->xvel[i] = shyguys->xvel[last];
+	shyguys->yvel[i] = shyguys->yvel[last];
+	shyguys->falling[i] = shyguys->falling[last];
+	shyguys->goal[i] = shyguys->goal[last];
+	shyguys->frame[i] = shyguys->frame[last];
+	shyguys->counter[i] = shyguys->counter[last];
+	shyguys->move[i] = shyguys->move[last];
+	shyguys->sprite[i] = shyguys->sprite[last];
+}
+
+/* empty the laser pool */
+void lasers_init(struct Lasers* lasers) {
+	lasers->count = 0;
+	lasers->cooldown = 0;
+}
+
+/* move the falco left or right returns if it is at edge of the screen */
+int falco_left(struct Falco* falco) {
+	/* face left */
+	sprite_set_horizontal_flip(falco->sprite, 1);
+	falco->move = 1;
+	falco->facing = 0;
+	/* if we are at the left end, just scroll the screen */
+	if ((falco->x >> 8) < falco->border) {
+		return 1;
+	} else {
+		/* else move left */
+		falco->x -= 256;
+		return 0;
+	}
+}
+
+int falco_right(struct Falco* falco) {
+	/* face right */
+	sprite_set_horizontal_flip(falco->sprite, 0);
+	falco->move = 1;
+	falco->facing = 1;
+	/* if we are at the right end, just scroll the screen */
+	if ((falco->x >> 8) > (SCREEN_WIDTH - 16 - falco->border)) {
+		return 1;
+	} else {
+		/* else move right */
+		falco->x += 256;
+		return 0;
+	}
+}
 
-struct Shyguy {
-	struct Sprite* sprite;
-	int x, y, origx;
-	int xvel;
-	int gravity;
-	int frame;
-	int animation_delay;
-	int counter;
-	int move;
-	int border;
-	int falling;
-	int facing;
+/* stop the falco from walking left/right */
+void falco_stop(struct Falco* falco) {
+	falco->move = 0;
+   // falco->frame = 64;
+	falco->counter = 7;
+	sprite_set_offset(falco->sprite, 64);
+}
+
+/* start the falco jumping, unless already fgalling */
+void falco_jump(struct Falco* falco) {
+	if (!falco->falling) {
+		falco->yvel = -1350;
+		falco->falling = 1;
+	}
+}
+
+/* finds which tile a screen coordinate maps to, taking scroll into account */
+IWRAM_CODE unsigned short tile_lookup(int x, int y, int xscroll, int yscroll, const unsigned short* tilemap, int tilemap_w, int tilemap_h) {
+
+	/* adjust for the scroll */
+	x += xscroll;
+	y += yscroll;
+
+	/* convert from screen coordinates to tile coordinates */
+	x >>= 3;
+	y >>= 3;
+
+	/* account for wraparound - GBA maps are almost always a power of two
+	 * across, which only needs a mask */
+	if ((tilemap_w & (tilemap_w - 1)) == 0) {
+		x &= tilemap_w - 1;
+	} else {
+		x %= tilemap_w;
+		if (x < 0) {
+			x += tilemap_w;
+		}
+	}
+	if ((tilemap_h & (tilemap_h - 1)) == 0) {
+		y &= tilemap_h - 1;
+	} else {
+		y %= tilemap_h;
+		if (y < 0) {
+			y += tilemap_h;
+		}
+	}
+
+	/* lookup this tile from the map */
+	int index = y * tilemap_w + x;
+
+	/* return the tile */
+	return tilemap[index];
+}
+
+/* the kinds of tile in a collision layer */
+#define TILE_EMPTY 0
+#define TILE_SOLID 1
+#define TILE_ONE_WAY 2
+#define TILE_HAZARD 3
+
+/* the collision layer mkassets makes for a map: 2 bits for each tile, 16
+ * tiles to a word, on a map of any width whose height is a power of two */
+struct CollisionMap {
+	const unsigned int* bits;
+	int width;
+	int height_shift;
+};
+
+/* the collision layer for the map the falco walks on */
+const struct CollisionMap level_collision = {
+	map_collision, map_collision_width, map_collision_height_shift
+};
+
+/* the kind of the tile at a tile coordinate, wrapping around the map */
+static inline int collision_tile(const struct CollisionMap* layer, int tx, int ty) {
+	/* there's no divide instruction, so only wrap when it's needed */
+	if ((unsigned int) tx >= (unsigned int) layer->width) {
+		tx %= layer->width;
+		if (tx < 0) {
+			tx += layer->width;
+		}
+	}
+	ty &= (1 << layer->height_shift) - 1;
+	int index = ty * layer->width + tx;
+	return (layer->bits[index >> 4] >> ((index & 15) << 1)) & 3;
+}
+
+/* which kinds of tile the box from (x, y) to (x + w - 1, y + h - 1) touches,
+ * in world pixels, as a mask with bit (1 << kind) set for each one */
+IWRAM_CODE int collision_box(const struct CollisionMap* layer, int x, int y, int w, int h) {
+	int kinds = 0;
+	for (int ty = y >> 3; ty <= (y + h - 1) >> 3; ty++) {
+		for (int tx = x >> 3; tx <= (x + w - 1) >> 3; tx++) {
+			kinds |= 1 << collision_tile(layer, tx, ty);
+		}
+	}
+	return kinds;
+}
+
+/* sweep the bottom edge of a box w pixels wide down from y0 to y1, checking
+ * every row of tiles on the way so nothing is skipped however fast it falls.
+ * returns the y of the top of the first tile it lands on, or -1 if none */
+IWRAM_CODE int collision_sweep_down(const struct CollisionMap* layer, int x, int w, int y0, int y1) {
+	for (int row = y0 >> 3; row <= y1 >> 3; row++) {
+		int kinds = collision_box(layer, x, row << 3, w, 1);
+
+		if (kinds & (1 << TILE_SOLID)) {
+			return row << 3;
+		}
+
+		/* platforms only stop things which were above them to start with */
+		if ((kinds & (1 << TILE_ONE_WAY)) && y0 <= (row << 3)) {
+			return row << 3;
+		}
+	}
+	return -1;
+}
+
+/* the kinds of things which bump into each other */
+#define BODY_FALCO 0
+#define BODY_SHYGUY 1
+#define BODY_LASER 2
+#define BODY_KINDS 3
+
+/* the most boxes which can be checked in one frame */
+#define MAX_BODIES 64
+
+/* a box on the screen, in pixels, and which entity of which kind it is */
+struct Body {
+	short left, top, right, bottom;
+	unsigned char kind;
+	unsigned char index;
 };
 
-struct Laser {
-	struct Sprite* sprite;
-	int x, y;
-	int frame;
-	int move;
-	int border;
-	int facing;
-};
+/* the boxes added this frame, and the order they were in sorted by their
+ * left edge last frame, which is nearly sorted for this frame already */
+struct Body bodies[MAX_BODIES];
+unsigned char body_order[MAX_BODIES];
+int body_count = 0;
+int body_last_count = -1;
+
+/* what to do when two kinds of body overlap, given the index of each */
+typedef void (*HitCallback)(void* context, int a, int b);
+HitCallback hit_callbacks[BODY_KINDS][BODY_KINDS];
+
+/* how many pairs of boxes were tested and how many overlapped last frame */
+unsigned int body_pairs_tested = 0;
+unsigned int body_pairs_hit = 0;
+
+/* call a function whenever a body of one kind overlaps one of another */
+void collision_register(int kind_a, int kind_b, HitCallback callback) {
+	hit_callbacks[kind_a][kind_b] = callback;
+}
+
+/* start a new frame of collisions */
+void bodies_begin() {
+	body_count = 0;
+}
+
+/* add a box for this frame */
+void body_add(int kind, int index, int x, int y, int w, int h) {
+	if (body_count == MAX_BODIES) {
+		return;
+	}
+	struct Body* body = &bodies[body_count++];
+	body->left = x;
+	body->top = y;
+	body->right = x + w;
+	body->bottom = y + h;
+	body->kind = kind;
+	body->index = index;
+}
+
+/* sort and sweep: sort the boxes on their left edge, then each box only
+ * needs checking against the ones which start before it ends */
+IWRAM_CODE void bodies_sweep(void* context) {
+	/* the same entities get added in the same order each frame, so unless
+	 * something spawned or died, last frame's order is a good start */
+	if (body_count != body_last_count) {
+		for (int i = 0; i < body_count; i++) {
+			body_order[i] = i;
+		}
+		body_last_count = body_count;
+	}
+
+	/* insertion sort is close to linear on a nearly sorted list */
+	for (int i = 1; i < body_count; i++) {
+		unsigned char index = body_order[i];
+		int left = bodies[index].left;
+		int j = i - 1;
+		while (j >= 0 && bodies[body_order[j]].left > left) {
+			body_order[j + 1] = body_order[j];
+			j--;
+		}
+		body_order[j + 1] = index;
+	}
+
+	body_pairs_tested = 0;
+	body_pairs_hit = 0;
+	for (int i = 0; i < body_count; i++) {
+		struct Body* a = &bodies[body_order[i]];
+		for (int j = i + 1; j < body_count; j++) {
+			struct Body* b = &bodies[body_order[j]];
+
+			/* everything from here on starts past the end of this box */
+			if (b->left >= a->right) {
+				break;
+			}
+			body_pairs_tested++;
+			if (b->top >= a->bottom || a->top >= b->bottom) {
+				continue;
+			}
+
+			/* pass the pair in the order the callback was registered with */
+			if (hit_callbacks[a->kind][b->kind]) {
+				body_pairs_hit++;
+				hit_callbacks[a->kind][b->kind](context, a->index, b->index);
+			} else if (hit_callbacks[b->kind][a->kind]) {
+				body_pairs_hit++;
+				hit_callbacks[b->kind][a->kind](context, b->index, a->index);
+			}
+		}
+	}
+}
+
+/* how far a laser goes each frame, in 1/256 pixels */
+#define LASER_SPEED 1024
+
+/* how many frames a laser lasts, long enough to cross the screen */
+#define LASER_LIFETIME 60
+
+/* the fewest frames between shots */
+#define LASER_COOLDOWN 8
+
+/* take a laser off the screen, its slot is freed by the next update */
+void laser_stop(struct Lasers* lasers, int i) {
+	lasers->life[i] = 0;
+	sprite_position(lasers->sprite[i], SCREEN_WIDTH, SCREEN_HEIGHT);
+}
+
+/* free a laser's slot by moving the last flying one into its place */
+void laser_retire(struct Lasers* lasers, int i) {
+	int last = --lasers->count;
+	sprite_free(lasers->sprite[i]);
+
+	lasers->x[i] = lasers->x[last];
+	lasers->y[i] = lasers->y[last];
+	lasers->xvel[i] = lasers->xvel[last];
+	lasers->life[i] = lasers->life[last];
+	lasers->sprite[i] = lasers->sprite[last];
+}
+
+/* move every laser forward, and retire the ones which are done */
+IWRAM_CODE void lasers_update(struct Lasers* lasers) {
+	if (lasers->cooldown > 0) {
+		lasers->cooldown--;
+	}
+
+	int i = 0;
+	while (i < lasers->count) {
+		int x = lasers->x[i] >> 8;
+		if (lasers->life[i] == 0 || x >= 230 || x < 5) {
+			/* the last one moves into this slot, so look at it next */
+			laser_retire(lasers, i);
+			continue;
+		}
+		lasers->life[i]--;
+		lasers->x[i] += lasers->xvel[i];
+		sprite_position(lasers->sprite[i], lasers->x[i] >> 8, (lasers->y[i] >> 8) + 12);
+		i++;
+	}
+}
+
+/* fire a laser from the falco the way he is facing, if he can */
+void laser_shoot(struct Lasers* lasers, struct Falco* falco){
+	if (lasers->cooldown > 0 || lasers->count == MAX_LASERS) {
+		return;
+	}
+	struct Sprite* sprite = sprite_init(SCREEN_WIDTH, SCREEN_HEIGHT, SIZE_32_16, 0, 0, 96, 0);
+	if (!sprite) {
+		return;
+	}
+	lasers->cooldown = LASER_COOLDOWN;
+
+	int i = lasers->count++;
+	lasers->sprite[i] = sprite;
+	lasers->x[i] = falco->x;
+	lasers->y[i] = falco->y;
+	lasers->xvel[i] = falco->facing ? LASER_SPEED : -LASER_SPEED;
+	lasers->life[i] = LASER_LIFETIME;
+	sprite_set_horizontal_flip(lasers->sprite[i], !falco->facing);
+	audio_play(SOUND_LASER);
+	sprite_position(lasers->sprite[i], (lasers->x[i] >> 8) + 5, (lasers->y[i] >> 8) + 12);
+}
+
+/* the part of the falco's sprite his feet take up, in pixels */
+#define FALCO_FEET_X 8
+#define FALCO_FEET_WIDTH 16
+
+/* update the falco */
+IWRAM_CODE void falco_update(struct Falco* falco, int xscroll) {
+	/* where his feet are in the world before moving */
+	int x = (falco->x >> 8) + xscroll + FALCO_FEET_X;
+	int feet = (falco->y >> 8) + 32;
+
+	/* update y position and speed if falling */
+	if (falco->falling) {
+		falco->y += falco->yvel;
+		falco->yvel += falco->gravity;
+	}
+
+	/* sweep his feet down over the rows of tiles he passed - going up, he
+	 * passes through platforms */
+	int new_feet = (falco->y >> 8) + 32;
+	int ground = -1;
+	if (new_feet >= feet) {
+		ground = collision_sweep_down(&level_collision, x, FALCO_FEET_WIDTH, feet, new_feet);
+	}
+
+	/* touching a hazard anywhere hurts */
+	falco->hurt = (collision_box(&level_collision, x, falco->y >> 8, FALCO_FEET_WIDTH, 32) & (1 << TILE_HAZARD)) != 0;
+
+	if (ground >= 0) {
+		/* stop the fall! */
+		falco->falling = 0;
+		falco->yvel = 0;
+
+		/* make him line up with the top of the block */
+		falco->y = (ground - 32) << 8;
+
+		/* move him down one because there is a one pixel gap in the image */
+		falco->y++;
+
+	} else {
+		/* he is falling now */
+		falco->falling = 1;
+	}
+	/* update animation if moving */
+	if (falco->move) {
+		falco->counter++;
+		if (falco->counter >= falco->animation_delay) {
+			falco->frame = falco->frame + 32;
+			if (falco->frame > 144) {
+				falco->frame = 112;
+			}
+			sprite_set_offset(falco->sprite, falco->frame);
+			falco->counter = 0;
+		}
+	}
+	/* set on screen position */
+	sprite_position(falco->sprite, falco->x >> 8, falco->y >> 8);
+}
+
+/* the shyguys find their way to the falco with a flow field: for every place
+ * near the screen where one can stand, which way to go next to get to him
+ * soonest. it's worked out backwards from where he stands, a few places
+ * each tick, and only again once he's on another tile - so steering a
+ * shyguy is one lookup however many there are. the field covers a window
+ * of columns kept as a ring, the way bg0 keeps the world */
+#define FLOW_COLUMNS 64
+#define FLOW_ROWS 32
+#define FLOW_NODES (FLOW_COLUMNS * FLOW_ROWS)
+
+/* how many places are worked back from each tick, there are usually a
+ * hundred or so in the window */
+#define FLOW_BUDGET 64
+
+/* the window moves along once the falco is this close to one side */
+#define FLOW_MARGIN 16
+
+/* the rows above somewhere to stand which have to be clear, for the
+ * bottom half of a shyguy */
+#define FLOW_HEADROOM 2
+
+/* how far a shyguy can jump, in tiles across, up and down */
+#define FLOW_JUMP_ACROSS 4
+#define FLOW_JUMP_RISE 4
+#define FLOW_JUMP_DROP 6
+
+/* each place's step: 0 if there is no way to the falco from there,
+ * otherwise FLOW_REACHED, FLOW_JUMP if it has to jump, and the columns to
+ * go across plus 8 in the low bits - 0 across is where the falco is */
+#define FLOW_REACHED 0x20
+#define FLOW_JUMP 0x10
+#define FLOW_ACROSS(step) (((step) & 15) - 8)
+
+/* for each column in the window, a bit for each row: where a shyguy can
+ * stand, the tiles which stop a fall (solid and one way), and the ones it
+ * can't go through (solid and hazards) */
+unsigned int flow_ground[FLOW_COLUMNS];
+unsigned int flow_floor[FLOW_COLUMNS];
+unsigned int flow_wall[FLOW_COLUMNS];
+
+/* the collision layer the field is worked out over and the shyguys move
+ * on - the level's, unless check.c gives them a map of its own */
+const struct CollisionMap* flow_layer = &level_collision;
+
+/* the world column at the left of the window */
+int flow_left = 0;
+
+/* the field the shyguys follow, and the one being worked out, with the
+ * places still to work back from */
+unsigned char flow_fields[2][FLOW_NODES] EWRAM_BSS __attribute__((aligned(4)));
+unsigned short flow_queue[FLOW_NODES] EWRAM_BSS;
+unsigned char* flow_field = flow_fields[0];
+unsigned char* flow_next = flow_fields[1];
+int flow_head = 0;
+int flow_tail = 0;
+int flow_working = 0;
+
+/* where the newest field leads to, -1 for nowhere yet */
+int flow_target_column = 0;
+int flow_target_row = -1;
+
+/* how many fields have been finished, and places worked back from */
+unsigned int flow_fields_done = 0;
+unsigned int flow_nodes_visited = 0;
+
+/* a mask of the rows from low to high */
+static inline unsigned int flow_rows(int low, int high) {
+	if (low < 0) {
+		low = 0;
+	}
+	if (high > FLOW_ROWS - 1) {
+		high = FLOW_ROWS - 1;
+	}
+	if (low > high) {
+		return 0;
+	}
+	return (0xffffffff >> (FLOW_ROWS - 1 - high)) & (0xffffffff << low);
+}
+
+static inline int flow_in_window(int column) {
+	return (unsigned int) (column - flow_left) < FLOW_COLUMNS;
+}
+
+static inline int flow_node(int column, int row) {
+	return ((column & (FLOW_COLUMNS - 1)) * FLOW_ROWS) | row;
+}
+
+/* the world column of a place in the window */
+static inline int flow_column(int node) {
+	return flow_left + ((node / FLOW_ROWS - flow_left) & (FLOW_COLUMNS - 1));
+}
+
+/* work out a column's rows from the collision layer */
+void flow_write_column(int column) {
+	int rows = 1 << flow_layer->height_shift;
+	if (rows > FLOW_ROWS) {
+		rows = FLOW_ROWS;
+	}
+	unsigned int floor = 0, wall = 0;
+	for (int row = 0; row < rows; row++) {
+		int kind = collision_tile(flow_layer, column, row);
+		if (kind == TILE_SOLID || kind == TILE_ONE_WAY) {
+			floor |= 1u << row;
+		}
+		if (kind == TILE_SOLID || kind == TILE_HAZARD) {
+			wall |= 1u << row;
+		}
+	}
+
+	/* somewhere to stand is a floor with room above it */
+	unsigned int ground = floor;
+	for (int row = 1; row <= FLOW_HEADROOM; row++) {
+		ground &= ~wall << row;
+	}
+
+	int slot = column & (FLOW_COLUMNS - 1);
+	flow_ground[slot] = ground;
+	flow_floor[slot] = floor;
+	flow_wall[slot] = wall;
+
+	/* what was known about the column which was here has gone */
+	for (int row = 0; row < FLOW_ROWS; row++) {
+		flow_field[slot * FLOW_ROWS + row] = 0;
+	}
+}
+
+/* move the window to start at another column, only the columns which come
+ * into it are worked out. the field being worked out is thrown away */
+void flow_move(int left) {
+	int old = flow_left;
+	flow_left = left;
+	for (int column = left; column < left + FLOW_COLUMNS; column++) {
+		if ((unsigned int) (column - old) >= FLOW_COLUMNS) {
+			flow_write_column(column);
+		}
+	}
+	flow_working = 0;
+	flow_target_row = -1;
+}
+
+/* forget everything and fill the window in around a column */
+void flow_reset(int column) {
+	for (int i = 0; i < FLOW_NODES / 4; i++) {
+		((unsigned int*) flow_field)[i] = 0;
+	}
+	flow_left = column - FLOW_COLUMNS / 2;
+	for (int i = 0; i < FLOW_COLUMNS; i++) {
+		flow_write_column(flow_left + i);
+	}
+	flow_working = 0;
+	flow_target_row = -1;
+}
+
+/* start working out a new field, leading to a place */
+void flow_start(int column, int row) {
+	for (int i = 0; i < FLOW_NODES / 4; i++) {
+		((unsigned int*) flow_next)[i] = 0;
+	}
+	flow_target_column = column;
+	flow_target_row = row;
+
+	int node = flow_node(column, row);
+	flow_next[node] = FLOW_REACHED | 8;
+	flow_queue[0] = node;
+	flow_head = 0;
+	flow_tail = 1;
+	flow_working = 1;
+}
+
+/* a shyguy at a place can get one step nearer by going across */
+static inline void flow_add(int column, int row, int across, int jump) {
+	int node = flow_node(column, row);
+	if (!flow_next[node]) {
+		flow_next[node] = FLOW_REACHED | jump | (across + 8);
+		flow_queue[flow_tail++] = node;
+	}
+}
+
+/* add every place a shyguy could get to this one from in a single move */
+IWRAM_CODE void flow_visit(int column, int row) {
+	/* the rows above this one which a shyguy could fall down through */
+	unsigned int stops = flow_floor[column & (FLOW_COLUMNS - 1)] | flow_wall[column & (FLOW_COLUMNS - 1)];
+	int top = row;
+	while (top > 0 && !(stops & (1u << (top - 1)))) {
+		top--;
+	}
+
+	/* walking over from next door, or off the edge of somewhere higher */
+	for (int side = -1; side <= 1; side += 2) {
+		int from = column + side;
+		if (!flow_in_window(from)) {
+			continue;
+		}
+		unsigned int ground = flow_ground[from & (FLOW_COLUMNS - 1)];
+		if (ground & (1u << row)) {
+			flow_add(from, row, -side, 0);
+		}
+		unsigned int drops = ground & flow_rows(top + FLOW_HEADROOM, row - 1);
+		while (drops) {
+			int high = __builtin_ctz(drops);
+			drops &= drops - 1;
+			flow_add(from, high, -side, 0);
+		}
+	}
+
+	/* jumping: up from anywhere, but across a gap or down only from an edge
+	 * where walking would do no good */
+	for (int across = -FLOW_JUMP_ACROSS; across <= FLOW_JUMP_ACROSS; across++) {
+		int from = column - across;
+		if (across == 0 || !flow_in_window(from)) {
+			continue;
+		}
+		int ahead = from + (across > 0 ? 1 : -1);
+		unsigned int edges = flow_in_window(ahead) ? ~flow_ground[ahead & (FLOW_COLUMNS - 1)] : ~0u;
+		unsigned int up = flow_rows(row + 1, row + FLOW_JUMP_RISE);
+		unsigned int level = (across == 1 || across == -1) ? 0 : edges & flow_rows(row - FLOW_JUMP_DROP, row);
+		unsigned int jumps = flow_ground[from & (FLOW_COLUMNS - 1)] & (up | level);
+
+		while (jumps) {
+			int start = __builtin_ctz(jumps);
+			jumps &= jumps - 1;
+
+			/* it goes over just above the higher of the two */
+			int high = start < row ? start : row;
+			unsigned int clear = flow_rows(high - FLOW_HEADROOM - 1, high - 1);
+			int blocked = 0;
+			for (int between = from + 1; between < column; between++) {
+				blocked |= flow_wall[between & (FLOW_COLUMNS - 1)] & clear;
+			}
+			for (int between = column + 1; between < from; between++) {
+				blocked |= flow_wall[between & (FLOW_COLUMNS - 1)] & clear;
+			}
+			if (!blocked) {
+				flow_add(from, start, across, FLOW_JUMP);
+			}
+		}
+	}
+}
+
+/* keep the window around the falco, and work a little more of the field out
+ * - once it's done, the shyguys use it and the next one starts whenever he
+ * has moved to another tile */
+IWRAM_CODE void flow_update(struct Falco* falco, int xscroll) {
+	int column = ((falco->x >> 8) + xscroll + FALCO_FEET_X + FALCO_FEET_WIDTH / 2) >> 3;
+	int row = ((falco->y >> 8) + 32) >> 3;
+	if (column - flow_left < FLOW_MARGIN || column - flow_left >= FLOW_COLUMNS - FLOW_MARGIN) {
+		flow_move(column - FLOW_COLUMNS / 2);
+	}
+
+	/* in the air he counts as being on the ground below him */
+	if (row < 0) {
+		row = 0;
+	}
+	unsigned int below = row < FLOW_ROWS ? flow_ground[column & (FLOW_COLUMNS - 1)] >> row : 0;
+	if (below && !flow_working) {
+		row += __builtin_ctz(below);
+		if (column != flow_target_column || row != flow_target_row) {
+			flow_start(column, row);
+		}
+	}
+
+	if (flow_working) {
+		int budget = FLOW_BUDGET;
+		while (budget-- > 0 && flow_head < flow_tail) {
+			int node = flow_queue[flow_head++];
+			flow_visit(flow_column(node), node & (FLOW_ROWS - 1));
+			flow_nodes_visited++;
+		}
+		if (flow_head == flow_tail) {
+			unsigned char* done = flow_next;
+			flow_next = flow_field;
+			flow_field = done;
+			flow_working = 0;
+			flow_fields_done++;
+		}
+	}
+}
+
+/* the step from a place, 0 if it isn't somewhere to stand with a way on */
+static inline int flow_step(int column, int row) {
+	if (!flow_in_window(column) || (unsigned int) row >= FLOW_ROWS) {
+		return 0;
+	}
+	return flow_field[flow_node(column, row)];
+}
+
+/* whether there's somewhere to stand at a place */
+static inline int flow_standing(int column, int row) {
+	return flow_in_window(column) && (unsigned int) row < FLOW_ROWS &&
+		(flow_ground[column & (FLOW_COLUMNS - 1)] & (1u << row));
+}
+
+/* how shyguys fall and jump, in 1/256 pixels a frame, the falco's gravity */
+#define SHYGUY_GRAVITY 50
+#define SHYGUY_JUMP 1100
+#define SHYGUY_AIR_SPEED 384
+
+/* the part of a shyguy's sprite which stands on things and bumps into
+ * walls: one tile across, so it fits a column when it's in the middle */
+#define SHYGUY_FEET_X 12
+#define SHYGUY_FEET_WIDTH 8
+
+/* the rows of its bottom half which bump into walls, less the pixel it
+ * sinks into the ground */
+#define SHYGUY_BODY_Y 16
+#define SHYGUY_BODY_H 14
+
+/* walk, jump and fall every shyguy towards the falco, the way the field
+ * says, or straight at him if it doesn't know */
+IWRAM_CODE void shyguys_move(struct Shyguys* shyguys, struct Falco* falco, int xscroll) {
+	int falcox = (falco->x >> 8) + xscroll;
+	int bottom = (1 << flow_layer->height_shift) * 8;
+	for (int i = 0; i < shyguys->count; i++) {
+		int x = shyguys->x[i] >> 8;
+		int column = (x + 16) >> 3;
+		int row = ((shyguys->y[i] >> 8) + 32) >> 3;
+
+		/* on the ground, look up where to go next - walking off an edge
+		 * it isn't over anywhere to stand, so it carries on. outside the
+		 * field it makes straight for him */
+		if (!shyguys->falling[i] && !flow_in_window(column)) {
+			shyguys->goal[i] = falcox;
+		} else if (!shyguys->falling[i] && flow_standing(column, row)) {
+			int step = flow_step(column, row);
+			if (step && FLOW_ACROSS(step) != 0) {
+				shyguys->goal[i] = ((column + FLOW_ACROSS(step)) << 3) + 4 - 16;
+				if (step & FLOW_JUMP) {
+					shyguys->yvel[i] = -SHYGUY_JUMP;
+					shyguys->falling[i] = 1;
+				}
+			} else {
+				shyguys->goal[i] = falcox;
+			}
+		}
+
+		/* head across for the goal, unless there's a wall */
+		int speed = shyguys->falling[i] ? SHYGUY_AIR_SPEED : shyguys->xvel[i];
+		int distance = (shyguys->goal[i] << 8) - shyguys->x[i];
+		int move = distance > speed ? speed : distance < -speed ? -speed : distance;
+		int to = (shyguys->x[i] + move) >> 8;
+		if (collision_box(flow_layer, to + SHYGUY_FEET_X, (shyguys->y[i] >> 8) + SHYGUY_BODY_Y,
+					SHYGUY_FEET_WIDTH, SHYGUY_BODY_H) & (1 << TILE_SOLID)) {
+			move = 0;
+		}
+		shyguys->x[i] += move;
+		shyguys->move[i] = move != 0;
+		if (move) {
+			sprite_set_horizontal_flip(shyguys->sprite[i], move < 0);
+		}
+
+		/* then fall, landing on things the same as the falco */
+		int feet = (shyguys->y[i] >> 8) + 32;
+		if (shyguys->falling[i]) {
+			shyguys->y[i] += shyguys->yvel[i];
+			shyguys->yvel[i] += SHYGUY_GRAVITY;
+		}
+		int new_feet = (shyguys->y[i] >> 8) + 32;
+		int ground = -1;
+		if (new_feet >= feet) {
+			ground = collision_sweep_down(flow_layer, (shyguys->x[i] >> 8) + SHYGUY_FEET_X,
+					SHYGUY_FEET_WIDTH, feet, new_feet);
+		}
+		if (ground >= 0) {
+			shyguys->falling[i] = 0;
+			shyguys->yvel[i] = 0;
+			shyguys->y[i] = ((ground - 32) << 8) + 1;
+		} else {
+			shyguys->falling[i] = 1;
+		}
+
+		/* one which fell off the bottom starts again */
+		if ((shyguys->y[i] >> 8) > bottom) {
+			shyguy_restart(shyguys, i);
+		}
+	}
+}
+
+/* animate the shyguys which are walking, and put their sprites where they
+ * are on the screen - ones well off the side are parked out of sight, so
+ * their x doesn't wrap round into view */
+IWRAM_CODE void shyguys_update(struct Shyguys* shyguys, int xscroll) {
+	for (int i = 0; i < shyguys->count; i++) {
+		if (shyguys->move[i]) {
+			if (++shyguys->counter[i] >= SHYGUY_ANIMATION_DELAY) {
+				/* the walk cycle is two frames, at tiles 0 and 32 */
+				shyguys->frame[i] ^= 32;
+				sprite_set_offset(shyguys->sprite[i], shyguys->frame[i]);
+				shyguys->counter[i] = 0;
+			}
+		}
+		int x = (shyguys->x[i] >> 8) - xscroll;
+		if (x < -32 || x > SCREEN_WIDTH) {
+			x = SCREEN_WIDTH;
+		}
+		sprite_position(shyguys->sprite[i], x, shyguys->y[i] >> 8);
+	}
+}
+
+/* print the score when it changes, the HUD only sends the digits which did */
+IWRAM_CODE void score_update(struct Score* score, struct Falco* falco){
+	if (falco->score != score->shown) {
+		score->shown = falco->score;
+		hud_print_number(SCORE_COLUMN + 6, SCORE_ROW, falco->score, SCORE_DIGITS);
+	}
+}
+
+/* Assembly function is dead, in iskill.s (reference.c on the host) */
+int iskill(int a, int b, int c);
 
-struct Score {
-	struct Sprite* sprite;
-	int x, y;
-	int frame;
-	int border;
+/* whether a shyguy has caught the falco - iskill takes his y as though the
+ * shyguy were standing where they start, on the bottom */
+int isdead(struct Shyguys* shyguys, int i, struct Falco* falco, int xscroll) {
+	int falcoy = (falco->y >> 8) - (shyguys->y[i] >> 8) + SHYGUY_START_Y;
+	int falcox = falco->x + (xscroll << 8);
+	return iskill(falcox, shyguys->x[i], falcoy);
+}
+
+/* everything that changes while the game is being played, it sits on the
+ * stack in internal work RAM so the entity loops run at full speed */
+struct Game {
+	struct Falco falco;
+	struct Shyguys shyguys;
+	struct Lasers lasers;
+	struct Score score;
+	int xscroll;
+	int dead;
+	int kills;
 };
 
-void score_init(struct Score* score){
-	score->x = 210 << 8;
-	score->y = 5 << 8;
-	
-	score->frame = 464;
-	score->border = 20;
-	score->sprite = sprite_init(score->x >> 8, score->y >> 8, SIZE_32_32, 0, 0, 464, 0);	
-}
+/* the laser hit a shyguy, which goes back to where it started */
+void laser_hit_shyguy(void* context, int laser, int shyguy) {
+	struct Game* game = context;
+	struct Shyguys* shyguys = &game->shyguys;
 
-/* initialize the falco */
-void falco_init(struct Falco* falco) {
-	falco->x = 100 << 8;
-	falco->y = 113 << 8;
-	falco->yvel = 0;
-	falco->gravity = 50;
-	falco->border = 40;
-	falco->frame = 112;
-	falco->move = 0;
-	falco->counter = 0;
-	falco->falling = 0;
-	falco->animation_delay = 8;
-	falco->facing = 1;
-	falco->score = 0;
-	falco->sprite = sprite_init(falco->x >> 8, falco->y >> 8, SIZE_32_32, 0, 0, 112, 0);
-}
+	/* a laser only gets one shyguy, even if it's touching two - it is
+	 * retired on its next update, so the indices in the sweep stay put */
+	if (game->lasers.life[laser] == 0) {
+		return;
+	}
+	laser_stop(&game->lasers, laser);
+	game->falco.score += 1;
+	audio_play(SOUND_HIT);
 
-/* initialize the Shy guy */
-void shyguy_init(struct Shyguy* shyguy, int xcoordinate){
-	shyguy->origx = xcoordinate << 8;
-	shyguy->x = xcoordinate << 8;
-	shyguy->y = 113 << 8;
-	shyguy->xvel = 64;
-	shyguy->gravity = 50;
-	shyguy->border = 40;
-	shyguy->frame = 0;
-	shyguy->move = 1;
-	shyguy->counter = 0;
-	shyguy->falling = 0;
-	shyguy->animation_delay = 8;
-	shyguy->facing = 0;
-	shyguy->sprite = sprite_init(shyguy->x >> 8, shyguy->y >> 8, SIZE_32_32, 0, 0, 0, 0);
-}
-
-void laser_init(struct Laser* laser){
-	laser->x = 240;
-	laser->y = 160;
-	laser->border = 40;
-	laser->frame = 0;
-	laser->move = 0;
-	laser->sprite = sprite_init(laser->x, laser->y, SIZE_32_16, 0, 0, 96, 0);
-	laser->facing = 1;
+	shyguy_restart(shyguys, shyguy);
 }
 
-/* move the falco left or right returns if it is at edge of the screen */
-int falco_left(struct Falco* falco) {
-	/* face left */
-	sprite_set_horizontal_flip(falco->sprite, 1);
-	falco->move = 1;
-	falco->facing = 0;
-	/* if we are at the left end, just scroll the screen */
-	if ((falco->x >> 8) < falco->border) {
-		return 1;
-	} else {
-		/* else move left */
-		falco->x -= 256;
-		return 0;
+/* a shyguy walked into the falco, which is the end unless he was above it */
+void shyguy_hit_falco(void* context, int shyguy, int falco) {
+	struct Game* game = context;
+	(void) falco;
+	if (isdead(&game->shyguys, shyguy, &game->falco, game->xscroll)) {
+		game->dead = 1;
 	}
 }
 
-int falco_right(struct Falco* falco) {
-	/* face right */
-	sprite_set_horizontal_flip(falco->sprite, 0);
-	falco->move = 1;
-	falco->facing = 1;
-	/* if we are at the right end, just scroll the screen */
-	if ((falco->x >> 8) > (SCREEN_WIDTH - 16 - falco->border)) {
-		return 1;
-	} else {
-		/* else move right */
-		falco->x += 256;
-		return 0;
+/* the parts of each sprite which count for collisions, in pixels: the
+ * falco's feet and body, the bottom half of a shyguy and the laser beam */
+#define FALCO_BOX_X FALCO_FEET_X
+#define FALCO_BOX_W FALCO_FEET_WIDTH
+#define FALCO_BOX_H 32
+#define SHYGUY_BOX_X 8
+#define SHYGUY_BOX_Y 16
+#define SHYGUY_BOX_W 16
+#define SHYGUY_BOX_H 16
+#define LASER_BOX_Y 16
+#define LASER_BOX_W 32
+#define LASER_BOX_H 8
+
+/* put a box around everything and let the broadphase find what touches */
+IWRAM_CODE void game_collide(struct Game* game) {
+	bodies_begin();
+
+	struct Falco* falco = &game->falco;
+	body_add(BODY_FALCO, 0, (falco->x >> 8) + FALCO_BOX_X, falco->y >> 8, FALCO_BOX_W, FALCO_BOX_H);
+
+	struct Shyguys* shyguys = &game->shyguys;
+	for (int i = 0; i < shyguys->count; i++) {
+		body_add(BODY_SHYGUY, i, (shyguys->x[i] >> 8) - game->xscroll + SHYGUY_BOX_X, (shyguys->y[i] >> 8) + SHYGUY_BOX_Y,
+				SHYGUY_BOX_W, SHYGUY_BOX_H);
+	}
+
+	struct Lasers* lasers = &game->lasers;
+	for (int i = 0; i < lasers->count; i++) {
+		body_add(BODY_LASER, i, lasers->x[i] >> 8, (lasers->y[i] >> 8) + LASER_BOX_Y, LASER_BOX_W, LASER_BOX_H);
 	}
+
+	bodies_sweep(game);
 }
 
-/* stop the falco from walking left/right */
-void falco_stop(struct Falco* falco) {
-	falco->move = 0;
-   // falco->frame = 64;
-	falco->counter = 7;
-	sprite_set_offset(falco->sprite, 64);
+/* a snapshot is everything a game needs to carry on from where it was, as
+ * little endian bytes in a fixed order - the version goes up whenever the
+ * layout changes, so old saves are turned down rather than misread. after
+ * the header come the game, the falco, the shyguys and the lasers, each
+ * sprite as its first two attributes and its frame; the rest of the buffer
+ * is zeros, so two snapshots always line up word for word. version 2 added
+ * the shyguys' steering, which took it from 1216 bytes to 1472 */
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_BYTES 1472
+#define SNAPSHOT_WORDS (SNAPSHOT_BYTES / 4)
+
+/* how many bytes the game, the falco and each shyguy take up, with the
+ * six of its sprite - the lasers' count comes after the last shyguy */
+#define SNAPSHOT_GAME_BYTES 6
+#define SNAPSHOT_FALCO_BYTES 27
+#define SNAPSHOT_SHYGUY_BYTES 35
+
+static inline void snapshot_put8(unsigned char** cursor, int value) {
+	*(*cursor)++ = value;
 }
 
-/* start the falco jumping, unless already fgalling */
-void falco_jump(struct Falco* falco) {
-	if (!falco->falling) {
-		falco->yvel = -1350;
-		falco->falling = 1;
-	}
+static inline void snapshot_put16(unsigned char** cursor, int value) {
+	snapshot_put8(cursor, value);
+	snapshot_put8(cursor, value >> 8);
+}
+
+static inline void snapshot_put32(unsigned char** cursor, int value) {
+	snapshot_put16(cursor, value);
+	snapshot_put16(cursor, value >> 16);
+}
+
+static inline int snapshot_get8(const unsigned char** cursor) {
+	return *(*cursor)++;
+}
+
+static inline int snapshot_get16(const unsigned char** cursor) {
+	int low = snapshot_get8(cursor);
+	return (short) (low | (snapshot_get8(cursor) << 8));
+}
+
+static inline int snapshot_get32(const unsigned char** cursor) {
+	unsigned int low = snapshot_get16(cursor) & 0xffff;
+	return low | ((unsigned int) snapshot_get16(cursor) << 16);
+}
+
+static inline void snapshot_put_sprite(unsigned char** cursor, const struct Sprite* sprite) {
+	snapshot_put16(cursor, sprite->attribute0);
+	snapshot_put16(cursor, sprite->attribute1);
+	snapshot_put16(cursor, sprite_frame[sprite - sprites]);
+}
+
+/* make a sprite again from what snapshot_put_sprite saved */
+struct Sprite* snapshot_get_sprite(const unsigned char** cursor, enum SpriteSize size) {
+	int attribute0 = snapshot_get16(cursor);
+	int attribute1 = snapshot_get16(cursor);
+	int frame = snapshot_get16(cursor);
+	struct Sprite* sprite = sprite_init(attribute1 & 0x1ff, attribute0 & 0xff, size,
+			(attribute1 >> 12) & 1, (attribute1 >> 13) & 1, frame, 0);
+	return sprite;
 }
 
-void shyguy_move(struct Shyguy* shyguy, struct Falco* falco){
-	if(falco->x > shyguy->x){
-		sprite_set_horizontal_flip(shyguy->sprite, 0);
-		shyguy->x += 128;
-		shyguy->move = 1;
+/* write a game into a snapshot buffer, returns how many bytes it took -
+ * this happens every frame, so it goes in IWRAM */
+IWRAM_CODE int snapshot_capture(const struct Game* game, unsigned int* snapshot) {
+	unsigned char* cursor = (unsigned char*) snapshot;
+	snapshot_put8(&cursor, 'S');
+	snapshot_put8(&cursor, 'N');
+	snapshot_put8(&cursor, SNAPSHOT_VERSION);
+	snapshot_put8(&cursor, 0);
+
+	snapshot_put32(&cursor, game->xscroll);
+	snapshot_put8(&cursor, game->dead);
+	snapshot_put8(&cursor, game->kills);
+
+	const struct Falco* falco = &game->falco;
+	snapshot_put32(&cursor, falco->x);
+	snapshot_put32(&cursor, falco->y);
+	snapshot_put32(&cursor, falco->yvel);
+	snapshot_put16(&cursor, falco->frame);
+	snapshot_put8(&cursor, falco->counter);
+	snapshot_put8(&cursor, falco->move);
+	snapshot_put8(&cursor, falco->falling);
+	snapshot_put8(&cursor, falco->facing);
+	snapshot_put16(&cursor, falco->score);
+	snapshot_put8(&cursor, falco->hurt);
+	snapshot_put_sprite(&cursor, falco->sprite);
+
+	const struct Shyguys* shyguys = &game->shyguys;
+	snapshot_put8(&cursor, shyguys->count);
+	for (int i = 0; i < shyguys->count; i++) {
+		snapshot_put32(&cursor, shyguys->x[i]);
+		snapshot_put32(&cursor, shyguys->y[i]);
+		snapshot_put32(&cursor, shyguys->origx[i]);
+		snapshot_put32(&cursor, shyguys->xvel[i]);
+		snapshot_put32(&cursor, shyguys->yvel[i]);
+		snapshot_put8(&cursor, shyguys->falling[i]);
+		snapshot_put32(&cursor, shyguys->goal[i]);
+		snapshot_put16(&cursor, shyguys->frame[i]);
+		snapshot_put8(&cursor, shyguys->counter[i]);
+		snapshot_put8(&cursor, shyguys->move[i]);
+		snapshot_put_sprite(&cursor, shyguys->sprite[i]);
+	}
+
+	const struct Lasers* lasers = &game->lasers;
+	snapshot_put8(&cursor, lasers->count);
+	snapshot_put8(&cursor, lasers->cooldown);
+	for (int i = 0; i < lasers->count; i++) {
+		snapshot_put32(&cursor, lasers->x[i]);
+		snapshot_put32(&cursor, lasers->y[i]);
+		snapshot_put32(&cursor, lasers->xvel[i]);
+		snapshot_put8(&cursor, lasers->life[i]);
+		snapshot_put_sprite(&cursor, lasers->sprite[i]);
 	}
-	else if(falco->x < shyguy->x){
-		shyguy->facing = 1;
-		sprite_set_horizontal_flip(shyguy->sprite, 1);
-		shyguy->x -= 128;
-		shyguy->move = 1;
+
+	/* zero the rest, a word at a time */
+	int length = cursor - (unsigned char*) snapshot;
+	while ((cursor - (unsigned char*) snapshot) & 3) {
+		*cursor++ = 0;
 	}
-	else{
-		shyguy->move = 0;
+	for (int w = (cursor - (unsigned char*) snapshot) / 4; w < SNAPSHOT_WORDS; w++) {
+		snapshot[w] = 0;
 	}
+	return length;
 }
 
-/* finds which tile a screen coordinate maps to, taking scroll into account */
-unsigned short tile_lookup(int x, int y, int xscroll, int yscroll, const unsigned short* tilemap, int tilemap_w, int tilemap_h) {
-
-	/* adjust for the scroll */
-	x += xscroll;
-	y += yscroll;
+/* put a game back the way a snapshot has it, returns -1 if it isn't one this
+ * version can read, leaving the game alone. the things which never change
+ * during a game, like gravity, stay as they are */
+int snapshot_restore(struct Game* game, const unsigned int* snapshot) {
+	const unsigned char* cursor = (const unsigned char*) snapshot;
+	if (snapshot_get8(&cursor) != 'S' || snapshot_get8(&cursor) != 'N' ||
+			snapshot_get8(&cursor) != SNAPSHOT_VERSION) {
+		return -1;
+	}
+	cursor++;
 
-	/* convert from screen coordinates to tile coordinates */
-	x >>= 3;
-	y >>= 3;
+	/* check the counts before anything is changed */
+	const unsigned char* counts = cursor + SNAPSHOT_GAME_BYTES + SNAPSHOT_FALCO_BYTES;
+	int shyguy_count = counts[0];
+	if (shyguy_count > MAX_SHYGUYS || counts[1 + shyguy_count * SNAPSHOT_SHYGUY_BYTES] > MAX_LASERS) {
+		return -1;
+	}
 
-	/* account for wraparound */
-	while (x >= tilemap_w) {
-		x -= tilemap_w;
+	/* every sprite is made again, the tile cache still has their frames */
+	struct Falco* falco = &game->falco;
+	struct Shyguys* shyguys = &game->shyguys;
+	struct Lasers* lasers = &game->lasers;
+	sprite_free(falco->sprite);
+	for (int i = 0; i < shyguys->count; i++) {
+		sprite_free(shyguys->sprite[i]);
 	}
-	while (y >= tilemap_h) {
-		y -= tilemap_h;
+	for (int i = 0; i < lasers->count; i++) {
+		sprite_free(lasers->sprite[i]);
 	}
-	while (x < 0) {
-		x += tilemap_w;
+
+	game->xscroll = snapshot_get32(&cursor);
+	game->dead = snapshot_get8(&cursor);
+	game->kills = snapshot_get8(&cursor);
+
+	falco->x = snapshot_get32(&cursor);
+	falco->y = snapshot_get32(&cursor);
+	falco->yvel = snapshot_get32(&cursor);
+	falco->frame = snapshot_get16(&cursor);
+	falco->counter = snapshot_get8(&cursor);
+	falco->move = snapshot_get8(&cursor);
+	falco->falling = snapshot_get8(&cursor);
+	falco->facing = snapshot_get8(&cursor);
+	falco->score = snapshot_get16(&cursor);
+	falco->hurt = snapshot_get8(&cursor);
+	falco->sprite = snapshot_get_sprite(&cursor, SIZE_32_32);
+
+	shyguys->count = snapshot_get8(&cursor);
+	for (int i = 0; i < shyguys->count; i++) {
+		shyguys->x[i] = snapshot_get32(&cursor);
+		shyguys->y[i] = snapshot_get32(&cursor);
+		shyguys->origx[i] = snapshot_get32(&cursor);
+		shyguys->xvel[i] = snapshot_get32(&cursor);
+		shyguys->yvel[i] = snapshot_get32(&cursor);
+		shyguys->falling[i] = snapshot_get8(&cursor);
+		shyguys->goal[i] = snapshot_get32(&cursor);
+		shyguys->frame[i] = snapshot_get16(&cursor);
+		shyguys->counter[i] = snapshot_get8(&cursor);
+		shyguys->move[i] = snapshot_get8(&cursor);
+		shyguys->sprite[i] = snapshot_get_sprite(&cursor, SIZE_32_32);
 	}
-	while (y < 0) {
-		y += tilemap_h;
+
+	lasers->count = snapshot_get8(&cursor);
+	lasers->cooldown = snapshot_get8(&cursor);
+	for (int i = 0; i < lasers->count; i++) {
+		lasers->x[i] = snapshot_get32(&cursor);
+		lasers->y[i] = snapshot_get32(&cursor);
+		lasers->xvel[i] = snapshot_get32(&cursor);
+		lasers->life[i] = snapshot_get8(&cursor);
+		lasers->sprite[i] = snapshot_get_sprite(&cursor, SIZE_32_16);
 	}
 
-	/* lookup this tile from the map */
-	int index = y * tilemap_w + x;
+	/* the score and bg1's bands show the restored game from the next frame */
+	game->score.shown = -1;
+	score_update(&game->score, falco);
+	parallax_build(&effect, game->xscroll);
+	return 0;
+}
 
-	/* return the tile */
-	return tilemap[index];
+/* holding L steps the game back a frame at a time. each frame, the words of
+ * its snapshot which changed are XORed with the last frame's and saved in a
+ * ring in EWRAM as runs: a count of words which didn't change, a count which
+ * did, then those words. each record has its length before and after it, so
+ * the newest can be taken off the end and the oldest dropped off the start */
+#define REWIND_KEY BUTTON_L
+#define REWIND_BYTES 0x10000
+#define REWIND_LONGEST_RUN 255
+
+/* the longest a record can be, with every word changed */
+#define REWIND_MAX_RECORD (4 + SNAPSHOT_BYTES + 2 * (SNAPSHOT_WORDS / REWIND_LONGEST_RUN + 1))
+
+unsigned char rewind_ring[REWIND_BYTES] EWRAM_BSS;
+unsigned int rewind_current[SNAPSHOT_WORDS] EWRAM_BSS;
+unsigned int rewind_next[SNAPSHOT_WORDS] EWRAM_BSS;
+
+/* where the oldest record starts and the newest ends, they only go up and
+ * are wrapped into the ring when used */
+unsigned int rewind_start = 0;
+unsigned int rewind_end = 0;
+
+/* how many frames back it can go */
+int rewind_frames = 0;
+
+static inline void rewind_put8(unsigned int* position, int value) {
+	rewind_ring[(*position)++ & (REWIND_BYTES - 1)] = value;
 }
 
-/* collision detection, offscreen detection, and moving the laser forward */
-void laser_update(struct Laser* laser, struct Shyguy* shyguy, struct Falco* falco){
-	if((laser->x >> 8) >= 230 || (laser->x >> 8) < 5){
-		laser->move = 0;
-		laser->x = 240;
-		laser->y = 160;
-		sprite_position(laser->sprite, laser->x, laser->y);
-	}
-	else if(laser->move == 1){
-		if(shyguy->x > laser->x && laser->facing == 0 && ((laser->y >> 8) + 12 > shyguy->y >> 8) && (falco->x > shyguy->x)){
-			laser->x = 240;
-			laser->y = 160;
-			laser->move = 0;
-			sprite_position(laser->sprite, laser->x, laser->y);
-			falco->score += 1;
-			
-			shyguy->x = shyguy->origx;
-			shyguy->y = 113 << 8;
-			sprite_position(shyguy->sprite,shyguy->origx >> 8,shyguy->y >> 8);
-		}
-		else if(laser->x > shyguy->x && (laser->facing == 1) && ((laser->y >> 8) + 12 > shyguy->y >> 8) && (falco->x < shyguy->x)){
-			laser->x = 240;
-			laser->y = 160;
-			laser->move = 0;
-			sprite_position(laser->sprite, laser->x, laser->y);
-			falco->score += 1;
-		
-			shyguy->x = shyguy->origx;
-			shyguy->y = 113 << 8;
-			sprite_position(shyguy->sprite,shyguy->origx >> 8 ,shyguy->y >> 8);
-		}
-		else {
-			if(laser->facing == 1){
-				laser->x += 512;
-			}
-			else{
-				laser->x -= 512;
-			}
-			sprite_position(laser->sprite, laser->x >> 8, (laser->y >> 8) + 12);
+static inline int rewind_get8(unsigned int position) {
+	return rewind_ring[position & (REWIND_BYTES - 1)];
+}
+
+/* forget the history, and start it from where the game is now */
+void rewind_reset(const struct Game* game) {
+	rewind_start = rewind_end = 0;
+	rewind_frames = 0;
+	snapshot_capture(game, rewind_current);
+}
+
+/* save what changed this frame */
+IWRAM_CODE void rewind_push(const struct Game* game) {
+	snapshot_capture(game, rewind_next);
+
+	/* make room for the biggest record there could be */
+	while (rewind_end - rewind_start > REWIND_BYTES - REWIND_MAX_RECORD) {
+		rewind_start += 4 + (rewind_get8(rewind_start) | (rewind_get8(rewind_start + 1) << 8));
+		rewind_frames--;
+	}
+
+	/* the length goes in once the record is written */
+	unsigned int record = rewind_end;
+	unsigned int position = record + 2;
+	int w = 0;
+	while (w < SNAPSHOT_WORDS) {
+		int skip = 0;
+		while (w < SNAPSHOT_WORDS && skip < REWIND_LONGEST_RUN && rewind_next[w] == rewind_current[w]) {
+			skip++;
+			w++;
+		}
+		if (w == SNAPSHOT_WORDS) {
+			break;
 		}
-		
+		int count = 0;
+		unsigned int count_position = position + 1;
+		rewind_put8(&position, skip);
+		rewind_put8(&position, 0);
+		while (w < SNAPSHOT_WORDS && count < REWIND_LONGEST_RUN && rewind_next[w] != rewind_current[w]) {
+			unsigned int change = rewind_next[w] ^ rewind_current[w];
+			rewind_put8(&position, change);
+			rewind_put8(&position, change >> 8);
+			rewind_put8(&position, change >> 16);
+			rewind_put8(&position, change >> 24);
+			rewind_current[w] = rewind_next[w];
+			count++;
+			w++;
+		}
+		rewind_ring[count_position & (REWIND_BYTES - 1)] = count;
 	}
-}
 
-void laser_shoot(struct Laser* laser, struct Falco* falco){
-	laser->facing = falco->facing;
-	laser->x = falco->x;
-	laser->y = falco->y;
-	laser->move = 1;
-	sprite_position(laser->sprite, (laser->x >> 8) + 5, (laser->y >> 8) + 12);
-	/*update animation when shooting */
+	int length = position - record - 2;
+	rewind_ring[record & (REWIND_BYTES - 1)] = length;
+	rewind_ring[(record + 1) & (REWIND_BYTES - 1)] = length >> 8;
+	rewind_put8(&position, length);
+	rewind_put8(&position, length >> 8);
+	rewind_end = position;
+	rewind_frames++;
 }
 
-/* update the falco */
-void falco_update(struct Falco* falco, int xscroll) {
-	/* update y position and speed if falling */
-	if (falco->falling) {
-		falco->y += falco->yvel;
-		falco->yvel += falco->gravity;
+/* go back a frame, returns 0 if there's nothing further back */
+IWRAM_CODE int rewind_step(struct Game* game) {
+	if (rewind_frames == 0) {
+		return 0;
 	}
+	int length = rewind_get8(rewind_end - 2) | (rewind_get8(rewind_end - 1) << 8);
+	unsigned int position = rewind_end - 2 - length;
+	unsigned int end = rewind_end - 2;
+	int w = 0;
+	while (position < end) {
+		w += rewind_get8(position++);
+		int count = rewind_get8(position++);
+		for (int i = 0; i < count; i++, w++) {
+			unsigned int change = rewind_get8(position) | (rewind_get8(position + 1) << 8) |
+				(rewind_get8(position + 2) << 16) | ((unsigned int) rewind_get8(position + 3) << 24);
+			rewind_current[w] ^= change;
+			position += 4;
+		}
+	}
+	rewind_end -= 4 + length;
+	rewind_frames--;
 
-	/* check which tile the falco's feet are over */
-	unsigned short tile = tile_lookup((falco->x >> 8) + 8, (falco->y >> 8) + 32, xscroll,
-			0, map, map_width, map_height);
+	snapshot_restore(game, rewind_current);
+	return 1;
+}
 
-	/* if it's block tile
-	 * these numbers refer to the tile indices of the blocks the falco can walk on */
-	if ((tile >= 1 && tile <= 6) || 
-		(tile >= 12 && tile <= 17)) {
-		/* stop the fall! */
-		falco->falling = 0;
-		falco->yvel = 0;
+/* the save slots in SRAM, each a magic number, the snapshot's length and a
+ * checksum of it, then the snapshot - the profiler has 0x7000 on */
+#define SAVE_SLOTS 3
+#define SAVE_SLOT_BYTES 0x800
+#define SAVE_HEADER_BYTES 8
 
-		/* make him line up with the top of a block
-		 * works by clearing out the lower bits to 0 */
-		falco->y &= ~0x7ff;
+/* select plus up saves to the first slot, select plus down loads it */
+#define SAVE_KEYS (BUTTON_SELECT | BUTTON_UP)
+#define LOAD_KEYS (BUTTON_SELECT | BUTTON_DOWN)
 
-		/* move him down one because there is a one pixel gap in the image */
-		falco->y++;
+unsigned short save_last_keys = 0;
 
-	} else {
-		/* he is falling now */
-		falco->falling = 1;
+/* save a game to a slot, SRAM is 8 bits wide so it goes a byte at a time */
+int save_slot(const struct Game* game, int slot) {
+	if (slot < 0 || slot >= SAVE_SLOTS) {
+		return -1;
 	}
-	/* update animation if moving */
-	if (falco->move) {
-		falco->counter++;
-		if (falco->counter >= falco->animation_delay) {
-			falco->frame = falco->frame + 32;
-			if (falco->frame > 144) {
-				falco->frame = 112;
-			}
-			sprite_set_offset(falco->sprite, falco->frame);
-			falco->counter = 0;
-		}
+	unsigned int* snapshot = rewind_next;
+	int length = snapshot_capture(game, snapshot);
+	const unsigned char* bytes = (const unsigned char*) snapshot;
+	unsigned short checksum = 0;
+	for (int i = 0; i < length; i++) {
+		checksum = checksum * 31 + bytes[i];
 	}
-	/* set on screen position */
-	sprite_position(falco->sprite, falco->x >> 8, falco->y >> 8);
-}
 
-void shyguy_update(struct Shyguy* shyguy, int xscroll){
-	/*update animation if moving */
-	if(shyguy->move == 1){
-		shyguy->counter++;
-		if(shyguy->counter >= shyguy->animation_delay) {
-			shyguy->frame = shyguy->frame + 32;
-			if (shyguy->frame > 32) {
-				shyguy->frame = 0;
-			} 
-			sprite_set_offset(shyguy->sprite, shyguy->frame);
-			shyguy->counter = 0;
-		}     
-	   sprite_position(shyguy->sprite, shyguy->x>>8, shyguy->y >>8);
+	volatile unsigned char* sram = (volatile unsigned char*) SRAM_ADDRESS(slot * SAVE_SLOT_BYTES);
+	const char* magic = "SAVE";
+	for (int i = 0; i < 4; i++) {
+		*sram++ = magic[i];
+	}
+	*sram++ = length;
+	*sram++ = length >> 8;
+	*sram++ = checksum;
+	*sram++ = checksum >> 8;
+	for (int i = 0; i < length; i++) {
+		*sram++ = bytes[i];
 	}
+	return 0;
 }
 
-// Declaring the assembly function
-int checkscore(int score);
-
-void score_update(struct Score* score, struct Falco* falco){
+/* load a game from a slot, returns -1 if there's no good save in it */
+int load_slot(struct Game* game, int slot) {
+	if (slot < 0 || slot >= SAVE_SLOTS) {
+		return -1;
+	}
+	volatile unsigned char* sram = (volatile unsigned char*) SRAM_ADDRESS(slot * SAVE_SLOT_BYTES);
+	const char* magic = "SAVE";
+	for (int i = 0; i < 4; i++) {
+		if (*sram++ != magic[i]) {
+			return -1;
+		}
+	}
+	int length = *sram++;
+	length |= *sram++ << 8;
+	unsigned short expected = *sram++;
+	expected |= *sram++ << 8;
+	if (length > SNAPSHOT_BYTES || length > SAVE_SLOT_BYTES - SAVE_HEADER_BYTES) {
+		return -1;
+	}
 
-	//Calling the assembly function, sets the correct sprite frame based on score
-	int frame = checkscore(falco->score);
-	sprite_set_offset(score->sprite, frame);
+	unsigned int* snapshot = rewind_next;
+	unsigned char* bytes = (unsigned char*) snapshot;
+	unsigned short checksum = 0;
+	for (int i = 0; i < SNAPSHOT_BYTES; i++) {
+		bytes[i] = i < length ? *sram++ : 0;
+		checksum = i < length ? checksum * 31 + bytes[i] : checksum;
+	}
+	if (checksum != expected) {
+		return -1;
+	}
+	return snapshot_restore(game, snapshot);
 }
 
-/* Assembly function is dead */
-int iskill(int a, int b, int c);
-
-int isdead(struct Shyguy* shyguy, struct Falco* falco) {
-	int falcoy = falco->y >> 8;
-	int falcox = falco->x;
-	int shyguyy = shyguy->y >> 8;
-	int shyguyx = shyguy->x;
-	
-	int ded = iskill(falcox, shyguyx, falcoy);
-	return ded; 
+/* look for the save and load keys, once each time they are pressed */
+void save_input(struct Game* game) {
+	unsigned short keys = input_keys;
+	unsigned short pressed = keys & ~save_last_keys;
+	save_last_keys = keys;
+	if ((keys & SAVE_KEYS) == SAVE_KEYS && (pressed & SAVE_KEYS)) {
+		save_slot(game, 0);
+	}
+	if ((keys & LOAD_KEYS) == LOAD_KEYS && (pressed & LOAD_KEYS)) {
+		load_slot(game, 0);
+	}
 }
 
-/* the main function */
-int main() {
+/* set up the screen and load the images and maps, this only has to happen
+ * once however many times the game is restarted */
+void game_load() {
+	/* the profiler overlay stays up across restarts, put it back after */
+	int overlay = overlay_shown;
+	overlay_show(0);
+
 	/* we set the mode to mode 0 with bg0 on */
 	*display_control = MODE0 | BG0_ENABLE | BG1_ENABLE | SPRITE_ENABLE | SPRITE_MAP_1D;
 
@@ -719,103 +3520,399 @@ int main() {
 	/* setup the sprite image data */
 	setup_sprite_image();
 
-	/* clear all the sprites on screen now */
+	/* wait for the images and maps to finish loading */
+	dma_flush_all();
+
+	/* the HUD's colors go over the end of the palette just loaded */
+	hud_init();
+
+	overlay_show(overlay);
+}
+
+/* put everything back at its starting position */
+void game_reset(struct Game* game) {
+	/* clear all the sprites on screen now, and any text */
 	sprite_clear();
+	hud_clear();
 
 	/* create the falco */
-	struct Falco falco;
-	falco_init(&falco);
-	/* create the shyguy */
-	struct Shyguy shyguy;
-	struct Shyguy shyguy2;
-	shyguy_init(&shyguy, 20);
-	shyguy_init(&shyguy2, 200);
-	/* create a laser */
-	struct Laser laser;
-	laser_init(&laser);
-	struct Score score;
-	score_init(&score);
+	falco_init(&game->falco);
+	/* create the shyguys */
+	shyguys_init(&game->shyguys);
+	shyguy_spawn(&game->shyguys, 20);
+	shyguy_spawn(&game->shyguys, 200);
+	/* set up the lasers */
+	lasers_init(&game->lasers);
+	score_init(&game->score);
 	
-	/* set initial scroll to 0 */
-	int xscroll = 0;
-	int dead = 0;
-	int kills = 0;
+	/* set initial scroll to 0, the level is drawn at the first vblank */
+	game->xscroll = 0;
+	world_init(&world, map, map_width, map_height);
+	flow_reset(((game->falco.x >> 8) + FALCO_FEET_X) >> 3);
+
+	/* bg1 scrolls in bands, fed in by hblank DMA */
+	effect_init(&effect, 0x014, 1);
+	game->dead = 0;
+	game->kills = 0;
+
+	/* what happens when things touch */
+	collision_register(BODY_LASER, BODY_SHYGUY, laser_hit_shyguy);
+	collision_register(BODY_SHYGUY, BODY_FALCO, shyguy_hit_falco);
+
+	/* nothing to rewind to yet */
+	rewind_reset(game);
+}
+
+/* set up the screen and the starting positions of everything */
+void game_init(struct Game* game) {
+	game_load();
+	game_reset(game);
+}
+
+/* returns whether the game is still being played */
+int game_running(struct Game* game) {
+	return game->dead == 0 && game->kills < 10;
+}
+
+/* run one 60 Hz tick of the game logic */
+IWRAM_CODE void game_tick(struct Game* game) {
+	profile_begin(PROFILE_TICK);
+	profile_begin(PROFILE_INPUT);
+	input_update();
+	profile_input();
+	save_input(game);
+	profile_end(PROFILE_INPUT);
+
+	/* while L is held the game runs backwards instead, select plus L is
+	 * the profiler's */
+	if ((input_keys & (REWIND_KEY | BUTTON_SELECT)) == REWIND_KEY) {
+		rewind_step(game);
+		profile_end(PROFILE_TICK);
+		return;
+	}
+
+	/* update the falco */
+	game->kills = game->falco.score;
 	
-	/* loop forever */
-	while (dead == 0 && kills < 10) {
-		/* update the falco */
-		kills = falco.score;
-		
-		falco_update(&falco, xscroll);
-		/*update the shyguy */
-		shyguy_update(&shyguy, xscroll);
-		shyguy_update(&shyguy2, xscroll);
-		/*update the laser */
-		
-		laser_update(&laser, &shyguy, &falco);
-		laser_update(&laser, &shyguy2, &falco);
-		score_update(&score, &falco);
-
-		if(isdead(&shyguy, &falco) || isdead(&shyguy2, &falco)){
-			dead = 1;
-		}
-
-		/* now the arrow keys move the falco */
-		if (button_pressed(BUTTON_RIGHT)) {
-			if (falco_right(&falco)) {
-				xscroll++;
-			}
-		} else if (button_pressed(BUTTON_LEFT)) {
-			if (falco_left(&falco)) {
-				xscroll--;
-			}
-		} else {
-			falco_stop(&falco);
-		}
+	profile_begin(PROFILE_FALCO);
+	falco_update(&game->falco, game->xscroll);
+	profile_end(PROFILE_FALCO);
+
+	/*update the shyguys */
+	profile_begin(PROFILE_ENEMIES);
+	shyguys_update(&game->shyguys, game->xscroll);
+	/*update the lasers */
+	lasers_update(&game->lasers);
+	profile_end(PROFILE_ENEMIES);
+
+	/* laser hits and the falco getting caught */
+	profile_begin(PROFILE_COLLISION);
+	game_collide(game);
+	profile_end(PROFILE_COLLISION);
+	score_update(&game->score, &game->falco);
+
+	if(game->falco.hurt){
+		game->dead = 1;
+	}
 
-		/* check for jumping */
-		
-		if (button_pressed(BUTTON_A)) {
-			falco_jump(&falco);
+	/* now the arrow keys move the falco */
+	if (button_pressed(BUTTON_RIGHT)) {
+		if (falco_right(&game->falco)) {
+			game->xscroll++;
 		}
+	} else if (button_pressed(BUTTON_LEFT)) {
+		if (falco_left(&game->falco)) {
+			game->xscroll--;
+		}
+	} else {
+		falco_stop(&game->falco);
+	}
+
+	/* check for jumping */
 	
-		if (button_pressed(BUTTON_B)){
-			laser_shoot(&laser, &falco);
+	if (button_pressed(BUTTON_A)) {
+		falco_jump(&game->falco);
+	}
+
+	if (button_pressed(BUTTON_B)){
+		laser_shoot(&game->lasers, &game->falco);
+	}
+
+	profile_begin(PROFILE_ENEMIES);
+	flow_update(&game->falco, game->xscroll);
+	shyguys_move(&game->shyguys, &game->falco, game->xscroll);
+	profile_end(PROFILE_ENEMIES);
+
+	/* the scroll for each line of bg1, shown from the next frame */
+	parallax_build(&effect, game->xscroll);
+
+	/* keep what changed, to come back to */
+	rewind_push(game);
+	profile_end(PROFILE_TICK);
+}
+
+/* the work which has to happen during vblank: scrolling and moving sprites */
+void game_vblank(struct Game* game) {
+	profile_begin(PROFILE_VBLANK);
+	world_update(&world, game->xscroll);
+	*bg0_x_scroll = game->xscroll;
+	effect_vblank(&effect);
+	profile_begin(PROFILE_SPRITES);
+	sprite_update_all();
+	profile_end(PROFILE_SPRITES);
+	dma_flush();
+	hud_flush();
+	overlay_draw();
+	profile_end(PROFILE_VBLANK);
+
+	/* the sound for next frame doesn't have to be done in vblank */
+	profile_begin(PROFILE_AUDIO);
+	audio_mix();
+	profile_end(PROFILE_AUDIO);
+
+	/* the frame is done, add it to the profile */
+	profile_frame();
+	frame_count++;
+}
+
+/* the screens the game goes between: a title, playing, and the win and
+ * lose screens, from which start plays again */
+#define SCENE_TITLE 0
+#define SCENE_PLAY 1
+#define SCENE_WIN 2
+#define SCENE_LOSE 3
+#define SCENES 4
+
+/* each scene has hooks for coming onto and going off the screen, which do
+ * any loading while it is faded out, and one for each logic tick */
+struct Scene {
+	void (*enter)(struct Game* game);
+	void (*exit)(struct Game* game);
+	void (*tick)(struct Game* game);
+};
+
+/* a change of scene fades out to black, swaps the scenes over and fades
+ * back in, the brightness going down or up a step each frame */
+#define FADE_NONE 0
+#define FADE_OUT 1
+#define FADE_IN 2
+#define FADE_STEPS 16
+
+int scene_current = SCENE_TITLE;
+int scene_next = SCENE_TITLE;
+int scene_fade = FADE_NONE;
+int scene_brightness = 0;
+
+/* the keys held last tick, so start only counts when it goes down */
+unsigned short scene_last_keys = 0;
+
+/* start going to another scene, unless one is on the way already */
+void scene_change(int scene) {
+	if (scene_fade == FADE_OUT) {
+		return;
+	}
+	scene_next = scene;
+	scene_fade = FADE_OUT;
+}
+
+/* whether start went down this tick, for the screens which wait for it */
+int scene_start_pressed() {
+	input_update();
+	unsigned short pressed = input_keys & ~scene_last_keys;
+	scene_last_keys = input_keys;
+	return (pressed & BUTTON_START) != 0;
+}
+
+/* the title goes over the level, with everything where it starts */
+void title_enter(struct Game* game) {
+	game_reset(game);
+	audio_music(1);
+	hud_print(11, 8, "COLLIDE");
+	hud_print(9, 11, "PRESS START");
+}
+
+void title_tick(struct Game* game) {
+	(void) game;
+	if (scene_start_pressed()) {
+		scene_change(SCENE_PLAY);
+	}
+}
+
+/* every game starts from the beginning, without loading anything again */
+void play_enter(struct Game* game) {
+	game_reset(game);
+	audio_music(1);
+}
+
+void play_tick(struct Game* game) {
+	game_tick(game);
+	if (!game_running(game)) {
+		if (game->dead) {
+			audio_play(SOUND_DEATH);
 		}
+		scene_change(game->dead ? SCENE_LOSE : SCENE_WIN);
+	}
+}
+
+/* the end screens go on bg1, which stops scrolling, and everything else
+ * stays where it was - the screen has faded to black by now, so the map
+ * can be unpacked straight in */
+void end_enter(const unsigned int* map, int column, const char* message) {
+	effect_stop(&effect);
+	audio_music(0);
+	load_asset(screen_block(24), map);
+	hud_print(column, 8, message);
+	hud_print(9, 11, "PRESS START");
+}
 
-		shyguy_move(&shyguy, &falco);
-		shyguy_move(&shyguy2, &falco);
+void win_enter(struct Game* game) {
+	(void) game;
+	end_enter(map4_packed, 11, "YOU WIN");
+}
 
+void lose_enter(struct Game* game) {
+	(void) game;
+	end_enter(map3_packed, 10, "GAME OVER");
+}
 
-		/* wait for vblank before scrolling and moving sprites */
-		wait_vblank();
-		*bg0_x_scroll = xscroll;
-		sprite_update_all();
+/* put bg1's own map back for the next game */
+void end_exit(struct Game* game) {
+	(void) game;
+	load_asset(screen_block(24), map2_packed);
+}
 
-		/* delay some */
-		delay(300);
+void end_tick(struct Game* game) {
+	(void) game;
+	if (scene_start_pressed()) {
+		scene_change(SCENE_PLAY);
 	}
-	/* when you lose */
-	while(1){
-		if(kills == 10){
-			memcpy16_dma((unsigned short*) screen_block(24), (unsigned short*) map4, map4_width * map4_height);
-		} else {
-			memcpy16_dma((unsigned short*) screen_block(24), (unsigned short*) map3, map3_width * map3_height); 
+}
+
+void scene_nothing(struct Game* game) {
+	(void) game;
+}
+
+const struct Scene scenes[SCENES] = {
+	{title_enter, scene_nothing, title_tick},   /* SCENE_TITLE */
+	{play_enter, scene_nothing, play_tick},     /* SCENE_PLAY */
+	{win_enter, end_exit, end_tick},            /* SCENE_WIN */
+	{lose_enter, end_exit, end_tick},           /* SCENE_LOSE */
+};
+
+/* load everything, once, and start off on a scene, fading in from black */
+void scene_start(struct Game* game, int scene) {
+	/* the brightness goes down on every layer and the backdrop */
+	*blend_control = 0x3f | (3 << 6);
+	scene_brightness = FADE_STEPS;
+	*blend_brightness = scene_brightness;
+	game_load();
+
+	scene_current = scene_next = scene;
+	scenes[scene].enter(game);
+	scene_fade = FADE_IN;
+}
+
+/* one logic tick of the scene - once the fade out has got to black the
+ * scenes are swapped over here, outside vblank, while nothing can be seen,
+ * and nothing moves until then */
+void scene_tick(struct Game* game) {
+	if (scene_fade == FADE_OUT && scene_brightness >= FADE_STEPS) {
+		scenes[scene_current].exit(game);
+		scene_current = scene_next;
+		scenes[scene_current].enter(game);
+		scene_fade = FADE_IN;
+
+		/* a key held from the last scene isn't a press in this one */
+		scene_last_keys = INPUT_KEY_BITS;
+	}
+	if (scene_fade != FADE_OUT) {
+		scenes[scene_current].tick(game);
+	}
+}
+
+/* the vblank work, and the next step of any fade, which only has to set
+ * the brightness register */
+void scene_vblank(struct Game* game) {
+	game_vblank(game);
+
+	if (scene_fade == FADE_OUT) {
+		if (scene_brightness < FADE_STEPS) {
+			scene_brightness++;
+		}
+	} else if (scene_fade == FADE_IN) {
+		if (--scene_brightness <= 0) {
+			scene_fade = FADE_NONE;
+		}
+	}
+	*blend_brightness = scene_brightness;
+}
+
+/* the host build has its own main in host.c */
+#ifndef HOST
+
+/* a recording made by the host build with -R replay.h can be built in and
+ * played back on the device */
+#ifdef REPLAY
+#include "replay.h"
+#endif
+
+/* the main function */
+int main() {
+	/* speed up the ROM, where everything but the hot loop runs from */
+	*wait_control = WAIT_ROM_FAST;
+
+	/* start counting vblanks, loading the game waits on them */
+	setup_interrupts();
+	profile_init();
+	audio_init();
+
+	struct Game game;
+#ifdef REPLAY
+	/* a replay starts straight into the game, the way it was recorded */
+	scene_start(&game, SCENE_PLAY);
+	input_replay(replay_runs, replay_run_count);
+#else
+	scene_start(&game, SCENE_TITLE);
+#endif
+
+	/* how many logic ticks to run this frame, more than one after a missed frame */
+	unsigned int ticks = 1;
+	
+	/* loop forever - on the still screens the ticks do next to nothing and
+	 * the CPU spends the frame halted in wait_vblank */
+	while (1) {
+		/* remember which vblank this frame started in */
+		unsigned int frame_start = vblank_count;
+
+		/* the logic runs at a fixed 60 Hz, one tick per vblank */
+		for (unsigned int tick = 0; tick < ticks; tick++) {
+			scene_tick(&game);
 		}
+
+		/* if a vblank already went by, the logic went over budget and those
+		 * frames were missed - catch up on their ticks next time round */
+		unsigned int late = vblank_count - frame_start;
+		missed_frames += late;
+		ticks = 1 + (late < MAX_CATCHUP_TICKS ? late : MAX_CATCHUP_TICKS);
+
+		/* sleep until vblank before scrolling and moving sprites */
+		wait_vblank();
+		scene_vblank(&game);
 	}
 }
 
+#endif
+
 /* the game boy advance uses "interrupts" to handle certain situations
- * for now we will ignore these */
+ * we handle vblank and ignore the rest */
 void interrupt_ignore() {
 	/* do nothing */
 }
 
-/* this table specifies which interrupts we handle which way
- * for now, we ignore all of them */
+/* this table specifies which interrupts we handle which way */
 typedef void (*intrp)();
 const intrp IntrTable[13] = {
-	interrupt_ignore,   /* V Blank interrupt */
+	on_vblank,          /* V Blank interrupt */
 	interrupt_ignore,   /* H Blank interrupt */
 	interrupt_ignore,   /* V Counter interrupt */
 	interrupt_ignore,   /* Timer 0 interrupt */
@@ -0,0 +1,110 @@
+@ crt0.s
+@ the startup code for the GBA build: the cartridge header, setting up the
+@ stacks, copying code and data into RAM, and an interrupt handler which
+@ calls the game's IntrTable - see gba.ld for where everything goes
+
+	.section .crt0, "ax"
+	.arm
+	.global _start
+_start:
+	b start
+
+	@ the logo, title and checksum, which gbafix fills in
+	.space 0xb2 - 4
+	.byte 0x96
+	.space 0xc0 - 0xb3
+
+start:
+	@ the interrupt stack, then the system mode one for the game, both in
+	@ the top of internal work RAM below the BIOS's area
+	mov r0, #0x12
+	msr cpsr_c, r0
+	ldr sp, =0x03007fa0
+	mov r0, #0x1f
+	msr cpsr_c, r0
+	ldr sp, =0x03007f00
+
+	@ copy the ARM code and the initialized data from ROM into IWRAM
+	ldr r0, =__iwram_lma
+	ldr r1, =__iwram_start
+	ldr r2, =__iwram_end
+	bl copy_words
+	ldr r0, =__data_lma
+	ldr r1, =__data_start
+	ldr r2, =__data_end
+	bl copy_words
+
+	@ zero the globals in IWRAM and the big arrays in EWRAM
+	ldr r0, =__bss_start
+	ldr r1, =__bss_end
+	bl zero_words
+	ldr r0, =__sbss_start
+	ldr r1, =__sbss_end
+	bl zero_words
+
+	@ the BIOS calls whatever this points to when an interrupt happens
+	ldr r0, =irq_handler
+	ldr r1, =0x03007ffc
+	str r0, [r1]
+
+	@ and off we go
+	ldr r0, =main
+	mov lr, pc
+	bx r0
+	b .
+
+@ copy words from r0 to r1 until r1 reaches r2
+copy_words:
+	cmp r1, r2
+	ldrlo r3, [r0], #4
+	strlo r3, [r1], #4
+	blo copy_words
+	bx lr
+
+@ zero words from r0 until r1
+zero_words:
+	mov r2, #0
+1:
+	cmp r0, r1
+	strlo r2, [r0], #4
+	blo 1b
+	bx lr
+
+@ runs in ARM and IRQ mode, with r0-r3, r12 and lr saved by the BIOS: find
+@ the lowest interrupt which is both enabled and flagged, acknowledge it, and
+@ call its entry in IntrTable
+irq_handler:
+	mov r3, #0x04000000
+	ldr r2, [r3, #0x200]
+	and r2, r2, r2, lsr #16
+	mov r1, #0
+1:
+	cmp r1, #13
+	bxhs lr
+	mov r0, #1
+	tst r2, r0, lsl r1
+	addeq r1, r1, #1
+	beq 1b
+
+	@ writing the bit to IF clears it
+	mov r0, r0, lsl r1
+	add r3, r3, #0x200
+	strh r0, [r3, #2]
+
+	ldr r0, =IntrTable
+	ldr r0, [r0, r1, lsl #2]
+	stmfd sp!, {lr}
+	mov lr, pc
+	bx r0
+	ldmfd sp!, {lr}
+	bx lr
+
+	.pool
+
+@ emulators and flash carts look through the ROM for this to know the game
+@ keeps its saves in 32 KB of battery backed SRAM - it has to start on a
+@ word boundary
+	.section .rodata
+	.align 2
+	.string "SRAM_V113"
+	.align 2
@@ -0,0 +1,50 @@
+/*
+ * driver.c
+ * what the PC drivers, host.c and bench.c, both need: a clock, the scripted
+ * keys and loading recordings - they include it after collide.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* the keys held on a given frame when no input is supplied: walk right,
+ * jumping and shooting now and then - the register is active low */
+unsigned short scripted_keys(unsigned int frame) {
+	unsigned short held = BUTTON_RIGHT;
+	if (frame % 50 < 3) {
+		held |= BUTTON_A;
+	}
+	if (frame % 30 == 0) {
+		held |= BUTTON_B;
+	}
+	return ~held & 0x3ff;
+}
+
+/* seconds on a monotonic clock */
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* load a binary recording of little endian runs, returns how many runs */
+unsigned int load_recording(const char* filename, unsigned short** runs) {
+	FILE* file = fopen(filename, "rb");
+	if (!file) {
+		perror(filename);
+		exit(1);
+	}
+	unsigned int count = 0, capacity = 1024;
+	*runs = malloc(capacity * sizeof(unsigned short));
+	int low, high;
+	while ((low = fgetc(file)) != EOF && (high = fgetc(file)) != EOF) {
+		if (count == capacity) {
+			capacity *= 2;
+			*runs = realloc(*runs, capacity * sizeof(unsigned short));
+		}
+		(*runs)[count++] = low | (high << 8);
+	}
+	fclose(file);
+	return count;
+}
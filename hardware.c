@@ -0,0 +1,154 @@
+/*
+ * hardware.c
+ * the host backend for hardware.h - GBA memory as plain arrays, plus
+ * stand-ins for DMA and the vblank interrupt
+ */
+
+#ifdef HOST
+
+#include <time.h>
+#include "hardware.h"
+
+/* the GBA memory areas, aligned so 16 and 32 bit accesses work like on the device */
+unsigned char host_io[0x400] __attribute__((aligned(4)));
+unsigned char host_palette[0x400] __attribute__((aligned(4)));
+unsigned char host_vram[0x18000] __attribute__((aligned(4)));
+unsigned char host_oam[0x400] __attribute__((aligned(4)));
+unsigned char host_bios_flags[4] __attribute__((aligned(4)));
+unsigned char host_sram[0x8000];
+
+/* the samples the FIFOs played last frame */
+signed char host_fifo_a[HOST_FIFO_SAMPLES];
+signed char host_fifo_b[HOST_FIFO_SAMPLES];
+int host_fifo_count = 0;
+unsigned int host_sample_rate = 0;
+
+/* the interrupt table is defined by the game */
+typedef void (*intrp)();
+extern const intrp IntrTable[13];
+
+/* where each channel's transfers which are waiting for something will read
+ * from next, and write to */
+static const volatile unsigned char* host_dma_source[4];
+static volatile unsigned char* host_dma_dest[4];
+
+/* move the units of one transfer, returning where the source got to */
+static const volatile unsigned char* dma_transfer(int channel, const volatile void* source,
+		volatile void* dest, unsigned int control) {
+	/* a count of 0 means the largest transfer the channel can do */
+	unsigned int count = control & 0xffff;
+	if (count == 0) {
+		count = (channel == 3) ? 0x10000 : 0x4000;
+	}
+
+	/* how the source and destination move after each unit: 0 increment, 1
+	 * decrement, 2 fixed, 3 increment (and reload, for the destination) */
+	int size = (control & DMA_32) ? 4 : 2;
+	int dest_step = ((control >> 21) & 3) == 1 ? -size : ((control >> 21) & 3) == 2 ? 0 : size;
+	int source_step = ((control >> 23) & 3) == 1 ? -size : ((control >> 23) & 3) == 2 ? 0 : size;
+
+	const volatile unsigned char* s = (const volatile unsigned char*) source;
+	volatile unsigned char* d = (volatile unsigned char*) dest;
+	for (unsigned int i = 0; i < count; i++) {
+		if (size == 4) {
+			*(volatile unsigned int*) d = *(const volatile unsigned int*) s;
+		} else {
+			*(volatile unsigned short*) d = *(const volatile unsigned short*) s;
+		}
+		s += source_step;
+		d += dest_step;
+	}
+	return s;
+}
+
+/* carry out a DMA transfer right away */
+void dma_start(int channel, const volatile void* source, volatile void* dest, unsigned int control) {
+	/* leave the control value where the game can read it back */
+	volatile unsigned int* regs = (volatile unsigned int*) IO_ADDRESS(0xb0 + channel * 12);
+	regs[2] = control & ~DMA_ENABLE;
+
+	/* transfers waiting for vblank, hblank or a sound FIFO are kept until
+	 * something triggers them, only hblank ones are ever carried out here */
+	if (!(control & DMA_ENABLE) || ((control >> 28) & 3) != 0) {
+		regs[2] = control;
+		host_dma_source[channel] = source;
+		host_dma_dest[channel] = dest;
+		return;
+	}
+
+	dma_transfer(channel, source, dest, control);
+}
+
+void host_hblank() {
+	for (int channel = 0; channel < 4; channel++) {
+		volatile unsigned int* regs = (volatile unsigned int*) IO_ADDRESS(0xb0 + channel * 12);
+		unsigned int control = regs[2];
+		if ((control & DMA_ENABLE) && ((control >> 28) & 3) == 2) {
+			host_dma_source[channel] = dma_transfer(channel, host_dma_source[channel],
+					host_dma_dest[channel], control);
+
+			/* the destination is put back every time, since that's all that
+			 * hblank effects use; without repeat it only happens once */
+			if (!(control & DMA_REPEAT)) {
+				regs[2] = control & ~DMA_ENABLE;
+			}
+		}
+	}
+}
+
+unsigned int host_cycles() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned int) (ts.tv_sec * 16777216ull + ts.tv_nsec * 16777216ull / 1000000000);
+}
+
+/* play a frame of sound into one FIFO's samples, from whichever DMA channel
+ * is feeding it, or silence if none is */
+static void host_fifo(volatile void* fifo, signed char* samples, int count) {
+	for (int channel = 1; channel <= 2; channel++) {
+		volatile unsigned int* regs = (volatile unsigned int*) IO_ADDRESS(0xb0 + channel * 12);
+		if ((regs[2] & DMA_ENABLE) && ((regs[2] >> 28) & 3) == 3 && host_dma_dest[channel] == fifo) {
+			for (int i = 0; i < count; i++) {
+				samples[i] = host_dma_source[channel][i];
+			}
+			host_dma_source[channel] += count;
+			return;
+		}
+	}
+	for (int i = 0; i < count; i++) {
+		samples[i] = 0;
+	}
+}
+
+/* act as though the screen just finished drawing */
+void host_vblank() {
+	volatile unsigned short* scanline = (volatile unsigned short*) IO_ADDRESS(0x006);
+	volatile unsigned short* enable = (volatile unsigned short*) IO_ADDRESS(0x200);
+	volatile unsigned short* flags = (volatile unsigned short*) IO_ADDRESS(0x202);
+	volatile unsigned short* master = (volatile unsigned short*) IO_ADDRESS(0x208);
+
+	*scanline = 160;
+	*flags |= 1;
+
+	/* the sound plays while the timer runs and the master switch is on */
+	volatile unsigned short* timer0 = (volatile unsigned short*) IO_ADDRESS(0x100);
+	volatile unsigned short* sound_status = (volatile unsigned short*) IO_ADDRESS(0x084);
+	host_fifo_count = 0;
+	if ((timer0[1] & 0x80) && (*sound_status & 0x80)) {
+		unsigned int period = 0x10000 - timer0[0];
+		host_sample_rate = 16777216 / period;
+		host_fifo_count = 280896 / period;
+		if (host_fifo_count > HOST_FIFO_SAMPLES) {
+			host_fifo_count = HOST_FIFO_SAMPLES;
+		}
+		host_fifo(IO_ADDRESS(0x0a0), host_fifo_a, host_fifo_count);
+		host_fifo(IO_ADDRESS(0x0a4), host_fifo_b, host_fifo_count);
+	}
+
+	/* run the handler if the game has asked for vblank interrupts */
+	if (*master && (*enable & 1)) {
+		IntrTable[0]();
+	}
+}
+
+#endif
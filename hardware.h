@@ -0,0 +1,185 @@
+/*
+ * hardware.h
+ * where the GBA hardware lives, either the real thing or, when built with
+ * -DHOST, plain memory arrays so the game can run headless on a PC
+ */
+
+#ifndef HARDWARE_H
+#define HARDWARE_H
+
+/* flag for turning on DMA */
+#define DMA_ENABLE 0x80000000
+
+/* flags for the sizes to transfer, 16 or 32 bits */
+#define DMA_16 0x00000000
+#define DMA_32 0x04000000
+
+/* flags to start a transfer at every hblank rather than right away, to do it
+ * again each time, and to put the destination back after each one */
+#define DMA_HBLANK 0x20000000
+#define DMA_REPEAT 0x02000000
+#define DMA_DEST_RELOAD 0x00600000
+
+/* flags for feeding a sound FIFO: start whenever it asks for more, and keep
+ * writing to the same place */
+#define DMA_SOUND 0x30000000
+#define DMA_DEST_FIXED 0x00400000
+
+#ifdef HOST
+
+/* there's only one kind of RAM on the host, and one kind of code */
+#define EWRAM_BSS
+#define IWRAM_CODE
+
+/* each area of the memory map is an array, sized like the real thing */
+extern unsigned char host_io[0x400];
+extern unsigned char host_palette[0x400];
+extern unsigned char host_vram[0x18000];
+extern unsigned char host_oam[0x400];
+extern unsigned char host_bios_flags[4];
+extern unsigned char host_sram[0x8000];
+
+/* addresses of the I/O registers, palette, VRAM and OAM */
+#define IO_ADDRESS(offset) ((volatile void*) (host_io + (offset)))
+#define PALETTE_ADDRESS(offset) ((volatile void*) (host_palette + (offset)))
+#define VRAM_ADDRESS(offset) ((volatile void*) (host_vram + (offset)))
+#define OAM_ADDRESS(offset) ((volatile void*) (host_oam + (offset)))
+#define BIOS_FLAGS_ADDRESS ((volatile void*) host_bios_flags)
+#define SRAM_ADDRESS(offset) ((volatile void*) (host_sram + (offset)))
+
+/* there is no DMA controller, so transfers happen as soon as they start */
+void dma_start(int channel, const volatile void* source, volatile void* dest, unsigned int control);
+
+/* there is no vblank either - this pretends one just happened, raising the
+ * interrupt if the game has it turned on */
+void host_vblank();
+
+/* or hblank - the renderer calls this after each line it draws, to carry
+ * out the transfers which are waiting for it */
+void host_hblank();
+
+/* or sound - at each vblank, the samples the two Direct Sound FIFOs played
+ * over the frame are taken from the DMA channels feeding them, at the rate
+ * timer 0 sets, and left here for the host to do what it likes with */
+#define HOST_FIFO_SAMPLES 4096
+extern signed char host_fifo_a[HOST_FIFO_SAMPLES];
+extern signed char host_fifo_b[HOST_FIFO_SAMPLES];
+extern int host_fifo_count;
+extern unsigned int host_sample_rate;
+
+/* nor timers, the cycle counter is the host's clock scaled to the GBA's
+ * 16.78 MHz, so profiles are in the same units even if not the same sizes */
+unsigned int host_cycles();
+
+static inline void cycle_counter_start() {
+}
+
+static inline unsigned int cycle_counter() {
+	return host_cycles();
+}
+
+/* "waiting" for vblank on the host just makes the next one happen */
+static inline void bios_vblank_wait() {
+	host_vblank();
+}
+
+/* C versions of the BIOS decompression calls, in bios.c */
+void bios_lz77_uncompress_vram(const void* source, volatile void* dest);
+void bios_rle_uncompress_vram(const void* source, volatile void* dest);
+void bios_huffman_uncompress(const void* source, volatile void* dest);
+
+#else
+
+/* put a big zeroed array in the 256K of external work RAM rather than the
+ * 32K of internal */
+#define EWRAM_BSS __attribute__((section(".sbss")))
+
+/* put a function in internal work RAM as ARM code, where it runs with no
+ * wait states on a 32 bit bus instead of as thumb from the 16 bit ROM - the
+ * startup code copies it there. it's too far from ROM for a normal branch */
+#define IWRAM_CODE __attribute__((section(".iwram"), target("arm"), long_call, noinline))
+
+/* addresses of the I/O registers, palette, VRAM and OAM */
+#define IO_ADDRESS(offset) ((volatile void*) (0x4000000 + (offset)))
+#define PALETTE_ADDRESS(offset) ((volatile void*) (0x5000000 + (offset)))
+#define VRAM_ADDRESS(offset) ((volatile void*) (0x6000000 + (offset)))
+#define OAM_ADDRESS(offset) ((volatile void*) (0x7000000 + (offset)))
+#define BIOS_FLAGS_ADDRESS ((volatile void*) 0x3007ff8)
+#define SRAM_ADDRESS(offset) ((volatile void*) (0xe000000 + (offset)))
+
+/* program one of the four DMA channels, each has 12 bytes of registers */
+static inline void dma_start(int channel, const volatile void* source, volatile void* dest, unsigned int control) {
+	volatile unsigned int* regs = (volatile unsigned int*) IO_ADDRESS(0xb0 + channel * 12);
+	regs[0] = (unsigned int) source;
+	regs[1] = (unsigned int) dest;
+	regs[2] = control;
+}
+
+/* count every CPU cycle with timers 2 and 3, the second counting each time
+ * the first overflows - timers 0 and 1 are left for sound */
+static inline void cycle_counter_start() {
+	volatile unsigned short* timers = (volatile unsigned short*) IO_ADDRESS(0x108);
+	timers[1] = 0;
+	timers[3] = 0;
+	timers[0] = 0;
+	timers[2] = 0;
+	timers[3] = 0x80 | 0x04;
+	timers[1] = 0x80;
+}
+
+/* the cycles counted so far - read the top half either side of the bottom
+ * in case the bottom wrapped in between */
+static inline unsigned int cycle_counter() {
+	volatile unsigned short* timers = (volatile unsigned short*) IO_ADDRESS(0x108);
+	unsigned int high, low;
+	do {
+		high = timers[2];
+		low = timers[0];
+	} while (high != timers[2]);
+	return (high << 16) | low;
+}
+
+/* the BIOS calls are made from thumb functions of their own, never inlined,
+ * so the swi is always the thumb encoding with the call number in its bottom
+ * byte, whatever the function calling them is built as. unused keeps quiet
+ * about the ones a file doesn't call */
+#define BIOS_CALL __attribute__((target("thumb"), noinline, unused))
+
+/* halt the CPU until the next vblank starts, using the BIOS VBlankIntrWait call */
+static BIOS_CALL void bios_vblank_wait() {
+	asm volatile("swi 0x05" ::: "r0", "r1", "r2", "r3", "memory");
+}
+
+/* call a BIOS decompression routine with the source in r0 and destination in r1 */
+#define BIOS_UNCOMPRESS(number, source, dest) do { \
+	register const void* r0 asm("r0") = (source); \
+	register volatile void* r1 asm("r1") = (dest); \
+	asm volatile("swi " #number : "+r"(r0), "+r"(r1) :: "r2", "r3", "memory"); \
+} while (0)
+
+/* the decompression calls which write 16 bits at a time, so they work on VRAM */
+static BIOS_CALL void bios_lz77_uncompress_vram(const void* source, volatile void* dest) {
+	BIOS_UNCOMPRESS(0x12, source, dest);
+}
+static BIOS_CALL void bios_rle_uncompress_vram(const void* source, volatile void* dest) {
+	BIOS_UNCOMPRESS(0x15, source, dest);
+}
+
+/* huffman always writes 32 bits at a time, so it works on VRAM as it is */
+static BIOS_CALL void bios_huffman_uncompress(const void* source, volatile void* dest) {
+	BIOS_UNCOMPRESS(0x13, source, dest);
+}
+
+#endif
+
+/* turn off a DMA channel, stopping a repeating transfer */
+static inline void dma_stop(int channel) {
+	((volatile unsigned int*) IO_ADDRESS(0xb0 + channel * 12))[2] = 0;
+}
+
+/* whether a DMA channel is still in the middle of a transfer */
+static inline int dma_busy(int channel) {
+	return (((volatile unsigned int*) IO_ADDRESS(0xb0 + channel * 12))[2] & DMA_ENABLE) != 0;
+}
+
+#endif
@@ -0,0 +1,232 @@
+/*
+ * host.c
+ * runs the game headless on a PC, as fast as it will go, for testing and
+ * profiling - build it with -DHOST along with hardware.c, render.c, bios.c
+ * and reference.c
+ *
+ * it goes through the title, the game and the end screens like the GBA,
+ * pressing start on the screens which wait for it
+ *
+ * usage: collide-host [-n frames] [-r] [-o last.ppm] [-R recording] [-P recording] [-w sound.wav]
+ *   -n  how many frames to run
+ *   -r  render every frame, and time it
+ *   -o  render the last frame and save it as an image
+ *   -R  record the keys, as binary or, if the name ends in .h, as a header
+ *       to build into the game with -DREPLAY - if the recording fills up,
+ *       what fitted is saved and it exits with status 1
+ *   -P  play back a binary recording, until it ends unless -n is given
+ *   -w  save the sound as a 16 bit mono WAV file, both FIFOs mixed together
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "render.h"
+
+/* the game itself is compiled right into this file, then what the drivers share */
+#include "collide.c"
+#include "driver.c"
+
+/* save what input_record captured */
+int save_recording(const char* filename) {
+	const char* dot = strrchr(filename, '.');
+	int header = dot && strcmp(dot, ".h") == 0;
+
+	FILE* file = fopen(filename, header ? "w" : "wb");
+	if (!file) {
+		return -1;
+	}
+	if (header) {
+		fprintf(file, "/* recorded by the host build */\n");
+		fprintf(file, "#define replay_run_count %u\n", input_run_count);
+		fprintf(file, "const unsigned short replay_runs[%u] = {", input_run_count ? input_run_count : 1);
+		for (unsigned int i = 0; i < input_run_count; i++) {
+			fprintf(file, "%s0x%04x,", (i % 8) ? " " : "\n\t", input_recording[i]);
+		}
+		fprintf(file, "\n};\n");
+	} else {
+		for (unsigned int i = 0; i < input_run_count; i++) {
+			fputc(input_recording[i] & 0xff, file);
+			fputc(input_recording[i] >> 8, file);
+		}
+	}
+	return fclose(file) == 0 ? 0 : -1;
+}
+
+/* write a WAV header for a number of 16 bit mono samples */
+void wav_header(FILE* file, unsigned int samples, unsigned int rate) {
+	unsigned int bytes = samples * 2;
+	unsigned int fields[] = {
+		0x46464952, 36 + bytes, 0x45564157,     /* "RIFF", size, "WAVE" */
+		0x20746d66, 16, 0x00010001, rate,       /* "fmt ", PCM, 1 channel */
+		rate * 2, 0x00100002,                   /* bytes a second, 16 bits */
+		0x61746164, bytes,                      /* "data" */
+	};
+	for (unsigned int i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+		for (int shift = 0; shift < 32; shift += 8) {
+			fputc(fields[i] >> shift, file);
+		}
+	}
+}
+
+/* add the last frame of sound, FIFO A and B play at full volume together */
+unsigned int wav_write_frame(FILE* file) {
+	for (int i = 0; i < host_fifo_count; i++) {
+		int sample = (host_fifo_a[i] + host_fifo_b[i]) * 128;
+		fputc(sample & 0xff, file);
+		fputc((sample >> 8) & 0xff, file);
+	}
+	return host_fifo_count;
+}
+
+int main(int argc, char** argv) {
+	/* how many frames to run, the game starts again whenever it ends */
+	unsigned int frames = 1000000;
+	int frames_given = 0;
+	int render_all = 0;
+	const char* image = NULL;
+	const char* record = NULL;
+	const char* play = NULL;
+	const char* sound = NULL;
+
+	int option;
+	while ((option = getopt(argc, argv, "n:ro:R:P:w:")) != -1) {
+		switch (option) {
+			case 'n': frames = strtoul(optarg, NULL, 0); frames_given = 1; break;
+			case 'r': render_all = 1; break;
+			case 'o': image = optarg; break;
+			case 'R': record = optarg; break;
+			case 'P': play = optarg; break;
+			case 'w': sound = optarg; break;
+			default:
+				fprintf(stderr, "usage: %s [-n frames] [-r] [-o last.ppm] [-R recording] [-P recording] [-w sound.wav]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	static Frame frame;
+	double render_time = 0;
+
+	setup_interrupts();
+	profile_init();
+	audio_init();
+	/* it goes through the scenes the way the GBA does, a recording starts
+	 * straight into the game the way one built in with -DREPLAY does */
+	struct Game game;
+	scene_start(&game, record || play ? SCENE_PLAY : SCENE_TITLE);
+
+	if (record) {
+		input_record();
+	}
+	if (play) {
+		unsigned short* runs;
+		unsigned int count = load_recording(play, &runs);
+		input_replay(runs, count);
+		if (!frames_given) {
+			frames = 0xffffffff;
+		}
+	}
+
+	/* the header goes in again at the end, once the length is known */
+	FILE* wav = NULL;
+	unsigned int samples = 0;
+	if (sound) {
+		wav = fopen(sound, "wb");
+		if (!wav) {
+			perror(sound);
+			return 1;
+		}
+		wav_header(wav, 0, 0);
+	}
+
+	unsigned int games = scene_current == SCENE_PLAY, wins = 0, deaths = 0;
+	unsigned long oam_bytes = 0;
+	double start = now();
+	unsigned int f;
+	for (f = 0; f < frames && !input_replay_done(); f++) {
+		/* off the game's own screen, press start now and then */
+		unsigned short keys = scripted_keys(f);
+		if (scene_current != SCENE_PLAY && f % 16 == 0) {
+			keys &= ~BUTTON_START;
+		}
+		*buttons = keys;
+
+		int scene = scene_current;
+		scene_tick(&game);
+		wait_vblank();
+		scene_vblank(&game);
+		oam_bytes += sprite_bytes_copied;
+		if (wav) {
+			samples += wav_write_frame(wav);
+		}
+
+		if (render_all) {
+			double before = now();
+			render_frame(frame);
+			render_time += now() - before;
+		}
+
+		/* count the games as their scenes come on */
+		if (scene_current != scene) {
+			games += scene_current == SCENE_PLAY;
+			wins += scene_current == SCENE_WIN;
+			deaths += scene_current == SCENE_LOSE;
+		}
+	}
+	frames = f;
+	double elapsed = now() - start;
+
+	printf("frames %u\n", frames);
+	printf("games %u wins %u deaths %u\n", games, wins, deaths);
+	printf("falco %d %d score %d\n", game.falco.x, game.falco.y, game.falco.score);
+	printf("vblanks %u\n", vblank_count);
+	printf("seconds %.3f\n", elapsed);
+	printf("frames/sec %.0f\n", frames / elapsed);
+	printf("OAM bytes/frame %.1f\n", frames ? (double) oam_bytes / frames : 0.0);
+	unsigned int lookups = tile_cache_hits + tile_cache_misses;
+	printf("tile cache hits %.1f%% misses %u bytes/frame %.1f\n",
+			lookups ? 100.0 * tile_cache_hits / lookups : 0.0, tile_cache_misses,
+			frames ? (double) tile_bytes_uploaded / frames : 0.0);
+
+	printf("flow fields %u places/field %.1f\n", flow_fields_done,
+			flow_fields_done ? (double) flow_nodes_visited / flow_fields_done : 0.0);
+
+	/* the profile of the last full window, in GBA cycles of host time */
+	printf("zone      min      avg      max\n");
+	for (int zone = 0; zone < PROFILE_ZONES; zone++) {
+		printf("%-8.8s %6u %8u %8u\n", profile_names[zone], profile_stats[zone].min,
+				profile_stats[zone].avg, profile_stats[zone].max);
+	}
+
+	if (render_all || image) {
+		/* rendering runs the hblank DMA on, so only draw a frame once */
+		if (!render_all) {
+			render_frame(frame);
+		}
+		printf("frame hash %08x\n", render_hash(frame));
+	}
+	if (render_all && frames > 0) {
+		printf("render usec/frame %.2f\n", render_time * 1e6 / frames);
+	}
+	if (record && save_recording(record) != 0) {
+		fprintf(stderr, "could not write %s\n", record);
+		return 1;
+	}
+	if (record && input_truncated) {
+		fprintf(stderr, "%s: the recording filled all %d runs and stops short of the end\n", record, INPUT_MAX_RUNS);
+	}
+	if (wav) {
+		rewind(wav);
+		wav_header(wav, samples, host_sample_rate);
+		if (fclose(wav) != 0) {
+			fprintf(stderr, "could not write %s\n", sound);
+			return 1;
+		}
+	}
+	if (image && render_write_ppm(image, frame) != 0) {
+		fprintf(stderr, "could not write %s\n", image);
+		return 1;
+	}
+	return record && input_truncated ? 1 : 0;
+}
@@ -0,0 +1,42 @@
+@ iskill.s
+@ int iskill(int falcox, int shyguyx, int falcoy)
+@ whether a shyguy catches the falco: their x positions, in 1/256 pixels, are
+@ less than 16 pixels apart and the falco's y, in pixels, is below 97 - the
+@ same as iskill in reference.c for any inputs
+@
+@ thumb code in ROM, like the game code which calls it, with no branches so
+@ it takes the same time whatever happens
+
+	.text
+	.thumb
+	.align 1
+	.global iskill
+	.thumb_func
+	.type iskill, %function
+iskill:
+	@ the distance between them, as an unsigned number
+	sub r0, r0, r1
+	asr r3, r0, #31
+	eor r0, r3
+	sub r0, r0, r3
+
+	@ it's under 16 << 8 if nothing is left above the low 12 bits, and
+	@ negating zero is the only time there's no borrow, which sets carry
+	lsr r0, r0, #12
+	neg r0, r0
+	mov r0, #0
+	adc r0, r0
+
+	@ flipping the sign bits turns a signed comparison into an unsigned one,
+	@ so falcoy > 97 sets carry comparing against 98
+	mov r1, #1
+	lsl r1, r1, #31
+	eor r2, r1
+	add r1, #98
+	cmp r2, r1
+	mov r1, #0
+	adc r1, r1
+
+	and r0, r1
+	bx lr
+	.size iskill, . - iskill
@@ -0,0 +1,20 @@
+/*
+ * reference.c
+ * C versions of the routines the GBA build has in assembly, in iskill.s -
+ * they give the same answer for every input, wrapping round where the
+ * numbers overflow the way the ARM does, and the host builds (host.c and
+ * bench.c) use them in place of the assembly
+ */
+
+#ifdef HOST
+
+int iskill(int falcox, int shyguyx, int falcoy) {
+	/* dead if the shyguy is within 16 pixels and the falco isn't above it */
+	unsigned int distance = (unsigned int) falcox - (unsigned int) shyguyx;
+	if ((int) distance < 0) {
+		distance = -distance;
+	}
+	return distance < (16 << 8) && falcoy > 97;
+}
+
+#endif
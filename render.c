@@ -0,0 +1,397 @@
+/*
+ * render.c
+ * the host software renderer - each scanline is drawn layer by layer into
+ * line buffers which are then composited back to front with SIMD selects,
+ * and the BLDCNT color effects applied on top
+ */
+
+#ifdef HOST
+
+#include <stdio.h>
+#include "hardware.h"
+#include "render.h"
+
+/* the compositing works on whole vectors of 16 bit pixels */
+#if defined(__AVX2__)
+#include <immintrin.h>
+typedef __m256i vec;
+#define VEC_LANES 16
+#define vec_load(p) _mm256_load_si256((const __m256i*) (p))
+#define vec_store(p, v) _mm256_store_si256((__m256i*) (p), (v))
+#define vec_set(x) _mm256_set1_epi16(x)
+#define vec_equal(a, b) _mm256_cmpeq_epi16((a), (b))
+#define vec_and(a, b) _mm256_and_si256((a), (b))
+#define vec_select(m, a, b) _mm256_blendv_epi8((b), (a), (m))
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+typedef __m128i vec;
+#define VEC_LANES 8
+#define vec_load(p) _mm_load_si128((const __m128i*) (p))
+#define vec_store(p, v) _mm_store_si128((__m128i*) (p), (v))
+#define vec_set(x) _mm_set1_epi16(x)
+#define vec_equal(a, b) _mm_cmpeq_epi16((a), (b))
+#define vec_and(a, b) _mm_and_si128((a), (b))
+#define vec_select(m, a, b) _mm_or_si128(_mm_and_si128((m), (a)), _mm_andnot_si128((m), (b)))
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+typedef uint16x8_t vec;
+#define VEC_LANES 8
+#define vec_load(p) vld1q_u16(p)
+#define vec_store(p, v) vst1q_u16((p), (v))
+#define vec_set(x) vdupq_n_u16(x)
+#define vec_equal(a, b) vceqq_u16((a), (b))
+#define vec_and(a, b) vandq_u16((a), (b))
+#define vec_select(m, a, b) vbslq_u16((m), (a), (b))
+#else
+typedef unsigned short vec;
+#define VEC_LANES 1
+#define vec_load(p) (*(p))
+#define vec_store(p, v) (*(p) = (v))
+#define vec_set(x) ((unsigned short) (x))
+#define vec_equal(a, b) ((unsigned short) ((a) == (b) ? 0xffff : 0))
+#define vec_and(a, b) ((unsigned short) ((a) & (b)))
+#define vec_select(m, a, b) ((unsigned short) (((m) & (a)) | (~(m) & (b))))
+#endif
+
+/* line buffers, aligned for the widest vectors */
+#define LINE_BUFFER(name) unsigned short name[RENDER_WIDTH] __attribute__((aligned(32)))
+
+/* read a register or a halfword of memory */
+static inline unsigned short io(int offset) {
+	return *(volatile unsigned short*) IO_ADDRESS(offset);
+}
+static inline unsigned short palette(int index) {
+	return ((unsigned short*) host_palette)[index];
+}
+
+/* the layers as the blend registers number them, one bit each */
+#define LAYER_SPRITES 0x10
+#define LAYER_BACKDROP 0x20
+
+/* what is showing on a line so far: the top pixel and the one under it,
+ * which blending mixes together, and which layer each came from */
+struct Line {
+	LINE_BUFFER(top);
+	LINE_BUFFER(below);
+	LINE_BUFFER(top_layer);
+	LINE_BUFFER(below_layer);
+};
+
+/* put one vector of a layer over the line wherever m is set, pushing what
+ * was on top down */
+static inline void composite_vec(struct Line* line, int x, vec s, vec m, vec layer) {
+	vec top = vec_load(line->top + x);
+	vec top_layer = vec_load(line->top_layer + x);
+	vec_store(line->below + x, vec_select(m, top, vec_load(line->below + x)));
+	vec_store(line->below_layer + x, vec_select(m, top_layer, vec_load(line->below_layer + x)));
+	vec_store(line->top + x, vec_select(m, s, top));
+	vec_store(line->top_layer + x, vec_select(m, layer, top_layer));
+}
+
+/* copy a background over the line wherever mask is set */
+static void composite(struct Line* line, const unsigned short* src, const unsigned short* mask, int layer) {
+	vec id = vec_set(layer);
+	for (int x = 0; x < RENDER_WIDTH; x += VEC_LANES) {
+		composite_vec(line, x, vec_load(src + x), vec_load(mask + x), id);
+	}
+}
+
+/* copy the sprite pixels of one priority over the line */
+static void composite_priority(struct Line* line, const unsigned short* src, const unsigned short* mask,
+		const unsigned short* priority, int level) {
+	vec want = vec_set(level);
+	vec id = vec_set(LAYER_SPRITES);
+	for (int x = 0; x < RENDER_WIDTH; x += VEC_LANES) {
+		vec m = vec_and(vec_load(mask + x), vec_equal(vec_load(priority + x), want));
+		composite_vec(line, x, vec_load(src + x), m, id);
+	}
+}
+
+/* the color effects of BLDCNT: alpha blending the top pixel with the one
+ * under it by BLDALPHA, or fading it towards white or black by BLDY -
+ * each only where the top pixel's layer is a first target, and for alpha
+ * the one under it a second target. the effect window isn't modelled */
+static void blend(struct Line* line) {
+	unsigned short control = io(0x050);
+	int mode = (control >> 6) & 3;
+	if (mode == 0) {
+		return;
+	}
+	int first = control & 0x3f;
+	int second = (control >> 8) & 0x3f;
+	int eva = io(0x052) & 0x1f, evb = (io(0x052) >> 8) & 0x1f;
+	int evy = io(0x054) & 0x1f;
+	eva = eva > 16 ? 16 : eva;
+	evb = evb > 16 ? 16 : evb;
+	evy = evy > 16 ? 16 : evy;
+
+	for (int x = 0; x < RENDER_WIDTH; x++) {
+		if (!(line->top_layer[x] & first)) {
+			continue;
+		}
+		unsigned short a = line->top[x], b = line->below[x];
+		if (mode == 1 && !(line->below_layer[x] & second)) {
+			continue;
+		}
+		unsigned short out = 0;
+		for (int shift = 0; shift < 15; shift += 5) {
+			int ca = (a >> shift) & 31, cb = (b >> shift) & 31;
+			int c;
+			if (mode == 1) {
+				c = (ca * eva + cb * evb) >> 4;
+				c = c > 31 ? 31 : c;
+			} else if (mode == 2) {
+				c = ca + (((31 - ca) * evy) >> 4);
+			} else {
+				c = ca - ((ca * evy) >> 4);
+			}
+			out |= c << shift;
+		}
+		line->top[x] = out;
+	}
+}
+
+/* the width and height in pixels of each sprite shape and size */
+static const unsigned char sprite_widths[3][4] = {{8, 16, 32, 64}, {16, 32, 32, 64}, {8, 8, 16, 32}};
+static const unsigned char sprite_heights[3][4] = {{8, 16, 32, 64}, {8, 8, 16, 32}, {16, 32, 32, 64}};
+
+/* draw one tiled background's pixels for a scanline */
+static void render_background(int bg, int line, unsigned short* color, unsigned short* mask) {
+	unsigned short control = io(0x008 + bg * 2);
+	int hofs = io(0x010 + bg * 4) & 0x1ff;
+	int vofs = io(0x012 + bg * 4) & 0x1ff;
+
+	int char_base = ((control >> 2) & 3) * 0x4000;
+	int screen_base = ((control >> 8) & 0x1f) * 0x800;
+	int colors256 = (control >> 7) & 1;
+	int size = (control >> 14) & 3;
+	int width = (size & 1) ? 512 : 256;
+	int height = (size & 2) ? 512 : 256;
+	const unsigned short* pal = (const unsigned short*) host_palette;
+
+	/* the row of the map this scanline falls in, wrapping around */
+	int y = (line + vofs) & (height - 1);
+
+	/* screen blocks are 32x32 entries, a 512 tall map has its lower half
+	 * one (256 wide) or two (512 wide) blocks on */
+	int row_base = screen_base;
+	if (y >= 256) {
+		row_base += (width == 512) ? 0x1000 : 0x800;
+	}
+	row_base += ((y & 255) >> 3) * 64;
+
+	int x = 0;
+	while (x < RENDER_WIDTH) {
+		int mx = (x + hofs) & (width - 1);
+		int block = row_base + ((mx >= 256) ? 0x800 : 0);
+		unsigned short entry = *(unsigned short*) (host_vram + ((block + ((mx & 255) >> 3) * 2) & 0xffff));
+
+		int tile = entry & 0x3ff;
+		int ty = (entry & 0x800) ? 7 - (y & 7) : (y & 7);
+		int flip = (entry & 0x400) ? 7 : 0;
+
+		/* draw from where we are in this tile up to its end */
+		int start = mx & 7;
+		int count = 8 - start;
+		if (count > RENDER_WIDTH - x) {
+			count = RENDER_WIDTH - x;
+		}
+
+		/* backgrounds only see the first 64 KB of VRAM - a tile past that,
+		 * in the sprites' part, comes out transparent */
+		int offset = char_base + (colors256 ? tile * 64 + ty * 8 : tile * 32 + ty * 4);
+		if (offset >= 0x10000) {
+			for (int tx = start; tx < start + count; tx++, x++) {
+				mask[x] = 0;
+			}
+		} else if (colors256) {
+			const unsigned char* pixels = host_vram + offset;
+			for (int tx = start; tx < start + count; tx++, x++) {
+				int index = pixels[tx ^ flip];
+				color[x] = pal[index];
+				mask[x] = -(index != 0);
+			}
+		} else {
+			const unsigned char* pixels = host_vram + offset;
+			const unsigned short* bank = pal + (entry >> 12) * 16;
+			for (int tx = start; tx < start + count; tx++, x++) {
+				int px = tx ^ flip;
+				int index = (pixels[px >> 1] >> ((px & 1) * 4)) & 0xf;
+				color[x] = bank[index];
+				mask[x] = -(index != 0);
+			}
+		}
+	}
+}
+
+/* draw the frontmost sprite pixel at each point of a scanline */
+static void render_sprites(int line, unsigned short* color, unsigned short* mask, unsigned short* priority) {
+	int map_1d = io(0x000) & 0x40;
+	const unsigned short* oam = (const unsigned short*) host_oam;
+
+	for (int x = 0; x < RENDER_WIDTH; x++) {
+		mask[x] = 0;
+		priority[x] = 4;
+	}
+
+	/* go from the back, so lower numbered sprites land on top */
+	for (int i = 127; i >= 0; i--) {
+		unsigned short a0 = oam[i * 4], a1 = oam[i * 4 + 1], a2 = oam[i * 4 + 2];
+
+		/* hidden and affine sprites are skipped, and so are window sprites */
+		if ((a0 & 0x300) != 0 || ((a0 >> 10) & 3) == 2 || (a0 >> 14) == 3) {
+			continue;
+		}
+
+		int w = sprite_widths[a0 >> 14][a1 >> 14];
+		int h = sprite_heights[a0 >> 14][a1 >> 14];
+		int row = (line - (a0 & 0xff)) & 0xff;
+		if (row >= h) {
+			continue;
+		}
+		if (a1 & 0x2000) {
+			row = h - 1 - row;
+		}
+
+		int sx = a1 & 0x1ff;
+		if (sx >= 256) {
+			sx -= 512;
+		}
+		int colors256 = (a0 >> 13) & 1;
+		int level = (a2 >> 10) & 3;
+		int base = a2 & 0x3ff;
+
+		/* in 1D mapping a sprite's tiles follow each other, in 2D each row of
+		 * tiles is 32 tiles apart */
+		int units = colors256 ? 2 : 1;
+		int row_stride = map_1d ? (w / 8) * units : 32;
+
+		for (int col = 0; col < w; col++) {
+			int x = sx + col;
+			if (x < 0 || x >= RENDER_WIDTH || priority[x] < level) {
+				continue;
+			}
+			int px = (a1 & 0x1000) ? w - 1 - col : col;
+			int tile = base + (row / 8) * row_stride + (px / 8) * units;
+			int offset = 0x10000 + ((tile * 32) & 0x7fff);
+
+			int index;
+			if (colors256) {
+				index = host_vram[offset + (row & 7) * 8 + (px & 7)];
+			} else {
+				unsigned char pair = host_vram[offset + (row & 7) * 4 + (px & 7) / 2];
+				index = (px & 1) ? pair >> 4 : pair & 0xf;
+				if (index) {
+					index += (a2 >> 12) * 16;
+				}
+			}
+
+			if (index) {
+				color[x] = palette(256 + index);
+				mask[x] = 0xffff;
+				priority[x] = level;
+			}
+		}
+	}
+}
+
+void render_scanline(int line, unsigned short* out) {
+	struct Line shown;
+	unsigned short* result = shown.top;
+	LINE_BUFFER(color);
+	LINE_BUFFER(mask);
+	LINE_BUFFER(sprite_color);
+	LINE_BUFFER(sprite_mask);
+	LINE_BUFFER(sprite_priority);
+
+	unsigned short control = io(0x000);
+
+	/* start from the backdrop color */
+	for (int x = 0; x < RENDER_WIDTH; x++) {
+		result[x] = shown.below[x] = palette(0);
+		shown.top_layer[x] = shown.below_layer[x] = LAYER_BACKDROP;
+	}
+
+	/* forced blank shows white, and only mode 0 is drawn */
+	if ((control & 0x80) || (control & 7) != 0) {
+		for (int x = 0; x < RENDER_WIDTH; x++) {
+			out[x] = (control & 0x80) ? 0x7fff : result[x] & 0x7fff;
+		}
+		return;
+	}
+
+	int sprites = control & 0x1000;
+	if (sprites) {
+		render_sprites(line, sprite_color, sprite_mask, sprite_priority);
+	}
+
+	/* paint from the lowest priority forward - at the same priority, lower
+	 * numbered backgrounds are in front and sprites are in front of them all */
+	for (int level = 3; level >= 0; level--) {
+		for (int bg = 3; bg >= 0; bg--) {
+			if ((control & (0x100 << bg)) && (io(0x008 + bg * 2) & 3) == level) {
+				render_background(bg, line, color, mask);
+				composite(&shown, color, mask, 1 << bg);
+			}
+		}
+		if (sprites) {
+			composite_priority(&shown, sprite_color, sprite_mask, sprite_priority, level);
+		}
+	}
+	blend(&shown);
+
+	/* the top bit of a color is unused */
+	vec low15 = vec_set(0x7fff);
+	for (int x = 0; x < RENDER_WIDTH; x += VEC_LANES) {
+		vec_store(result + x, vec_and(vec_load(result + x), low15));
+	}
+	for (int x = 0; x < RENDER_WIDTH; x++) {
+		out[x] = result[x];
+	}
+}
+
+void render_frame(Frame frame) {
+	for (int line = 0; line < RENDER_HEIGHT; line++) {
+		render_scanline(line, frame[line]);
+
+		/* hblank DMA can change the registers before the next line */
+		host_hblank();
+	}
+}
+
+unsigned int render_hash(Frame frame) {
+	/* FNV-1a over every pixel */
+	unsigned int hash = 2166136261u;
+	for (int y = 0; y < RENDER_HEIGHT; y++) {
+		for (int x = 0; x < RENDER_WIDTH; x++) {
+			hash = (hash ^ (frame[y][x] & 0xff)) * 16777619u;
+			hash = (hash ^ (frame[y][x] >> 8)) * 16777619u;
+		}
+	}
+	return hash;
+}
+
+int render_write_ppm(const char* filename, Frame frame) {
+	FILE* file = fopen(filename, "wb");
+	if (!file) {
+		return -1;
+	}
+
+	fprintf(file, "P6\n%d %d\n255\n", RENDER_WIDTH, RENDER_HEIGHT);
+	for (int y = 0; y < RENDER_HEIGHT; y++) {
+		unsigned char rgb[RENDER_WIDTH * 3];
+		for (int x = 0; x < RENDER_WIDTH; x++) {
+			/* stretch each 5 bit channel out to 8 bits */
+			unsigned short c = frame[y][x];
+			int r = c & 31, g = (c >> 5) & 31, b = (c >> 10) & 31;
+			rgb[x * 3] = (r << 3) | (r >> 2);
+			rgb[x * 3 + 1] = (g << 3) | (g >> 2);
+			rgb[x * 3 + 2] = (b << 3) | (b >> 2);
+		}
+		fwrite(rgb, 1, sizeof(rgb), file);
+	}
+
+	return fclose(file) == 0 ? 0 : -1;
+}
+
+#endif
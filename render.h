@@ -0,0 +1,28 @@
+/*
+ * render.h
+ * a software renderer for the host build, which draws what the GBA would
+ * show for the mode 0 backgrounds and sprites in the simulated hardware
+ */
+
+#ifndef RENDER_H
+#define RENDER_H
+
+#define RENDER_WIDTH 240
+#define RENDER_HEIGHT 160
+
+/* a whole screen of the GBA's 15 bit BGR colors */
+typedef unsigned short Frame[RENDER_HEIGHT][RENDER_WIDTH];
+
+/* draw one scanline of the screen from the current VRAM, OAM, palette and registers */
+void render_scanline(int line, unsigned short* out);
+
+/* draw the whole screen */
+void render_frame(Frame frame);
+
+/* a checksum of a frame, to compare against known good images */
+unsigned int render_hash(Frame frame);
+
+/* save a frame as a binary PPM image, returns 0 on success */
+int render_write_ppm(const char* filename, Frame frame);
+
+#endif
@@ -0,0 +1,438 @@
+/*
+ * gbapack.c
+ * packs a binary file with one of the compressions the GBA BIOS can undo,
+ * checks it unpacks to exactly the same bytes, and writes it out as a C
+ * header for load_asset
+ *
+ * build: gcc -O2 -DHOST -I.. gbapack.c ../bios.c -o gbapack
+ * usage: gbapack [-m raw|lz77|rle|huff4|huff8|best] [-n name] input.bin output.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hardware.h"
+#include "asset.h"
+
+/* the LZ77 window and the longest copy it can describe */
+#define LZ77_WINDOW 4096
+#define LZ77_LONGEST 18
+
+/* how many earlier places to try when looking for the longest copy */
+#define LZ77_TRIES 512
+
+/* a buffer which packed data is written into */
+struct Output {
+	unsigned char* data;
+	unsigned int size;
+};
+
+static void put(struct Output* out, unsigned char byte) {
+	out->data[out->size++] = byte;
+}
+
+static void put32(struct Output* out, unsigned int word) {
+	put(out, word & 0xff);
+	put(out, (word >> 8) & 0xff);
+	put(out, (word >> 16) & 0xff);
+	put(out, word >> 24);
+}
+
+/* the BIOS reads the data in words, so pad the end out */
+static void pad(struct Output* out) {
+	while (out->size & 3) {
+		put(out, 0);
+	}
+}
+
+static void pack_raw(const unsigned char* in, unsigned int size, struct Output* out) {
+	put32(out, ASSET_HEADER(ASSET_RAW, size));
+	memcpy(out->data + out->size, in, size);
+	out->size += size;
+	pad(out);
+}
+
+/* the hash chains only look at 3 byte prefixes, as nothing shorter is worth a copy */
+static unsigned int hash3(const unsigned char* p) {
+	return ((p[0] << 8) ^ (p[1] << 4) ^ p[2]) & (LZ77_WINDOW - 1);
+}
+
+static void pack_lz77(const unsigned char* in, unsigned int size, struct Output* out) {
+	int* head = malloc(LZ77_WINDOW * sizeof(int));
+	int* prev = malloc((size + 1) * sizeof(int));
+	for (int i = 0; i < LZ77_WINDOW; i++) {
+		head[i] = -1;
+	}
+
+	put32(out, ASSET_HEADER(ASSET_LZ77, size));
+
+	unsigned int pos = 0;
+	while (pos < size) {
+		unsigned int flag_at = out->size;
+		unsigned char flags = 0;
+		put(out, 0);
+
+		for (int bit = 7; bit >= 0 && pos < size; bit--) {
+			int best_length = 0, best_distance = 0;
+
+			if (pos + 3 <= size) {
+				int tries = 0;
+				for (int candidate = head[hash3(in + pos)]; candidate >= 0 && tries < LZ77_TRIES;
+						candidate = prev[candidate], tries++) {
+					int distance = pos - candidate;
+					if (distance > LZ77_WINDOW) {
+						break;
+					}
+
+					/* the VRAM safe BIOS call writes two bytes at a time, so it
+					 * can't copy from the byte it has just written */
+					if (distance < 2) {
+						continue;
+					}
+
+					int length = 0;
+					while (length < LZ77_LONGEST && pos + length < size && in[candidate + length] == in[pos + length]) {
+						length++;
+					}
+					if (length > best_length) {
+						best_length = length;
+						best_distance = distance;
+						if (length == LZ77_LONGEST) {
+							break;
+						}
+					}
+				}
+			}
+
+			/* either a copy or a plain byte, adding what we pass to the chains */
+			int step = 1;
+			if (best_length >= 3) {
+				flags |= 1 << bit;
+				put(out, ((best_length - 3) << 4) | ((best_distance - 1) >> 8));
+				put(out, (best_distance - 1) & 0xff);
+				step = best_length;
+			} else {
+				put(out, in[pos]);
+			}
+			for (int i = 0; i < step; i++, pos++) {
+				if (pos + 3 <= size) {
+					unsigned int h = hash3(in + pos);
+					prev[pos] = head[h];
+					head[h] = pos;
+				}
+			}
+		}
+
+		out->data[flag_at] = flags;
+	}
+
+	pad(out);
+	free(head);
+	free(prev);
+}
+
+static void pack_rle(const unsigned char* in, unsigned int size, struct Output* out) {
+	put32(out, ASSET_HEADER(ASSET_RLE, size));
+
+	unsigned int pos = 0;
+	while (pos < size) {
+		/* see how long a run starts here */
+		unsigned int run = 1;
+		while (pos + run < size && run < 130 && in[pos + run] == in[pos]) {
+			run++;
+		}
+
+		if (run >= 3) {
+			put(out, 0x80 | (run - 3));
+			put(out, in[pos]);
+			pos += run;
+		} else {
+			/* copy bytes as they are up to the next run of 3 */
+			unsigned int start = pos, length = 0;
+			while (pos < size && length < 128) {
+				if (pos + 2 < size && in[pos] == in[pos + 1] && in[pos] == in[pos + 2]) {
+					break;
+				}
+				pos++;
+				length++;
+			}
+			put(out, length - 1);
+			for (unsigned int i = 0; i < length; i++) {
+				put(out, in[start + i]);
+			}
+		}
+	}
+
+	pad(out);
+}
+
+/* a node of the huffman tree, leaves have no children */
+struct Node {
+	unsigned int weight;
+	int left, right;
+	int symbol;
+};
+
+/* returns 0 if the tree can't be laid out with the 6 bit child offsets the BIOS uses */
+static int pack_huffman(const unsigned char* in, unsigned int size, int bits, struct Output* out) {
+	int symbols = 1 << bits;
+	unsigned int count = (size * 8) / bits;
+
+	/* the symbols in the order the BIOS puts them back - low nibble first */
+	unsigned char* stream = malloc(count);
+	for (unsigned int i = 0; i < count; i++) {
+		stream[i] = (bits == 8) ? in[i] : (in[i / 2] >> ((i & 1) * 4)) & 0xf;
+	}
+
+	struct Node nodes[511];
+	int live[256];
+	int node_count = 0, live_count = 0;
+
+	unsigned int frequency[256] = {0};
+	for (unsigned int i = 0; i < count; i++) {
+		frequency[stream[i]]++;
+	}
+	for (int s = 0; s < symbols; s++) {
+		if (frequency[s]) {
+			nodes[node_count] = (struct Node) {frequency[s], -1, -1, s};
+			live[live_count++] = node_count++;
+		}
+	}
+
+	/* a tree needs two leaves, so add unused symbols if there aren't enough */
+	for (int s = 0; s < symbols && live_count < 2; s++) {
+		if (!frequency[s]) {
+			nodes[node_count] = (struct Node) {0, -1, -1, s};
+			live[live_count++] = node_count++;
+		}
+	}
+
+	/* keep joining the two lightest nodes until only the root is left */
+	while (live_count > 1) {
+		int a = 0, b = 1;
+		if (nodes[live[b]].weight < nodes[live[a]].weight) {
+			a = 1;
+			b = 0;
+		}
+		for (int i = 2; i < live_count; i++) {
+			if (nodes[live[i]].weight < nodes[live[a]].weight) {
+				b = a;
+				a = i;
+			} else if (nodes[live[i]].weight < nodes[live[b]].weight) {
+				b = i;
+			}
+		}
+		nodes[node_count] = (struct Node) {nodes[live[a]].weight + nodes[live[b]].weight, live[a], live[b], -1};
+		live[a] = node_count++;
+		live[b] = live[--live_count];
+	}
+	int root = live[0];
+
+	/* lay the tree out breadth first: each internal node points at a pair of
+	 * children an even number of bytes on, and sets the top bits for the
+	 * children which are symbols */
+	unsigned char table[1024] = {0};
+	int queue[511], place[511];
+	int first = 0, last = 0, next = 2;
+	queue[last] = root;
+	place[last++] = 1;
+
+	unsigned int code[256] = {0};
+	unsigned char length[256] = {0};
+	unsigned int node_code[511];
+	unsigned char node_length[511];
+	node_code[root] = 0;
+	node_length[root] = 0;
+
+	while (first < last) {
+		int n = queue[first];
+		int at = place[first++];
+		int offset = (next - (at & ~1) - 2) / 2;
+		if (offset > 63) {
+			free(stream);
+			return 0;
+		}
+
+		unsigned char entry = offset;
+		int children[2] = {nodes[n].left, nodes[n].right};
+		for (int side = 0; side < 2; side++) {
+			int child = children[side];
+			if (node_length[n] >= 32) {
+				free(stream);
+				return 0;
+			}
+			node_code[child] = (node_code[n] << 1) | side;
+			node_length[child] = node_length[n] + 1;
+
+			if (nodes[child].symbol >= 0) {
+				entry |= side ? 0x40 : 0x80;
+				table[next + side] = nodes[child].symbol;
+				code[nodes[child].symbol] = node_code[child];
+				length[nodes[child].symbol] = node_length[child];
+			} else {
+				queue[last] = child;
+				place[last++] = next + side;
+			}
+		}
+		table[at] = entry;
+		next += 2;
+	}
+
+	/* the table, with its size byte, has to keep the stream word aligned */
+	while (next & 3) {
+		next++;
+	}
+	table[0] = next / 2 - 1;
+
+	put32(out, ASSET_HEADER(ASSET_HUFFMAN | bits, size));
+	for (int i = 0; i < next; i++) {
+		put(out, table[i]);
+	}
+
+	/* the codes go into words from the top bit down */
+	unsigned int word = 0;
+	int used = 0;
+	for (unsigned int i = 0; i < count; i++) {
+		for (int b = length[stream[i]] - 1; b >= 0; b--) {
+			word = (word << 1) | ((code[stream[i]] >> b) & 1);
+			if (++used == 32) {
+				put32(out, word);
+				word = 0;
+				used = 0;
+			}
+		}
+	}
+	if (used) {
+		put32(out, word << (32 - used));
+	}
+
+	free(stream);
+	return 1;
+}
+
+/* unpack with the same routines the game uses and compare */
+static int verify(const unsigned char* in, unsigned int size, const struct Output* packed) {
+	unsigned int header = packed->data[0] | (packed->data[1] << 8) | (packed->data[2] << 16) | (packed->data[3] << 24);
+	unsigned char* check = calloc(size + 4, 1);
+
+	switch (ASSET_TYPE(header)) {
+		case ASSET_RAW: memcpy(check, packed->data + 4, size); break;
+		case ASSET_LZ77: bios_lz77_uncompress_vram(packed->data, check); break;
+		case ASSET_RLE: bios_rle_uncompress_vram(packed->data, check); break;
+		case ASSET_HUFFMAN: bios_huffman_uncompress(packed->data, check); break;
+	}
+
+	int same = ASSET_SIZE(header) == size && memcmp(in, check, size) == 0;
+	free(check);
+	return same;
+}
+
+/* pack with one method, returns 0 if the method couldn't be used */
+static int pack(const char* method, const unsigned char* in, unsigned int size, struct Output* out) {
+	out->size = 0;
+	if (strcmp(method, "raw") == 0) {
+		pack_raw(in, size, out);
+	} else if (strcmp(method, "lz77") == 0) {
+		pack_lz77(in, size, out);
+	} else if (strcmp(method, "rle") == 0) {
+		pack_rle(in, size, out);
+	} else if (strcmp(method, "huff4") == 0) {
+		return pack_huffman(in, size, 4, out);
+	} else if (strcmp(method, "huff8") == 0) {
+		return pack_huffman(in, size, 8, out);
+	} else {
+		return 0;
+	}
+	return 1;
+}
+
+int main(int argc, char** argv) {
+	const char* method = "best";
+	const char* name = "asset";
+
+	int option;
+	while ((option = getopt(argc, argv, "m:n:")) != -1) {
+		switch (option) {
+			case 'm': method = optarg; break;
+			case 'n': name = optarg; break;
+			default: argc = 0;
+		}
+	}
+	if (argc - optind != 2) {
+		fprintf(stderr, "usage: %s [-m raw|lz77|rle|huff4|huff8|best] [-n name] input.bin output.h\n", argv[0]);
+		return 1;
+	}
+
+	FILE* file = fopen(argv[optind], "rb");
+	if (!file) {
+		perror(argv[optind]);
+		return 1;
+	}
+	fseek(file, 0, SEEK_END);
+	long length = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	/* huffman unpacks in whole words, so round the size up with zeros */
+	unsigned int size = (length + 3) & ~3;
+	unsigned char* in = calloc(size + 1, 1);
+	if (fread(in, 1, length, file) != (size_t) length) {
+		perror(argv[optind]);
+		return 1;
+	}
+	fclose(file);
+
+	if (size >= (1 << 24)) {
+		fprintf(stderr, "%s: too big to pack\n", argv[optind]);
+		return 1;
+	}
+
+	/* plenty of room for the worst case of any method */
+	struct Output best = {malloc(size * 2 + 2048), 0};
+	struct Output trial = {malloc(size * 2 + 2048), 0};
+	const char* chosen = NULL;
+
+	const char* methods[] = {"raw", "lz77", "rle", "huff4", "huff8"};
+	for (int i = 0; i < 5; i++) {
+		if (strcmp(method, "best") != 0 && strcmp(method, methods[i]) != 0) {
+			continue;
+		}
+		if (!pack(methods[i], in, size, &trial)) {
+			fprintf(stderr, "%s: %s can't be used on this data\n", argv[optind], methods[i]);
+			continue;
+		}
+		if (!verify(in, size, &trial)) {
+			fprintf(stderr, "%s: %s did not unpack to the same bytes\n", argv[optind], methods[i]);
+			return 1;
+		}
+		if (!chosen || trial.size < best.size) {
+			struct Output swap = best;
+			best = trial;
+			trial = swap;
+			chosen = methods[i];
+		}
+	}
+	if (!chosen) {
+		fprintf(stderr, "%s: could not pack %s with %s\n", argv[0], argv[optind], method);
+		return 1;
+	}
+
+	file = fopen(argv[optind + 1], "w");
+	if (!file) {
+		perror(argv[optind + 1]);
+		return 1;
+	}
+	fprintf(file, "/* generated by gbapack from %s: %s, %u -> %u bytes */\n", argv[optind], chosen, size, best.size);
+	fprintf(file, "#define %s_size %u\n", name, size);
+	fprintf(file, "const unsigned int %s[%u] __attribute__((aligned(4))) = {", name, best.size / 4);
+	for (unsigned int i = 0; i < best.size; i += 4) {
+		unsigned int word = best.data[i] | (best.data[i + 1] << 8) | (best.data[i + 2] << 16) | ((unsigned int) best.data[i + 3] << 24);
+		fprintf(file, "%s0x%08x,", (i % 32) ? " " : "\n\t", word);
+	}
+	fprintf(file, "\n};\n");
+	fclose(file);
+
+	printf("%s: %s, %u -> %u bytes (%.1f%%)\n", argv[optind], chosen, size, best.size, 100.0 * best.size / size);
+	return 0;
+}
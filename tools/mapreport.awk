@@ -0,0 +1,60 @@
+# mapreport.awk
+# turns the output of `nm -S -n program.elf` into a table of where each
+# function and variable ended up, and for functions a rough count of the
+# cycles it takes just to fetch their code once, straight through - which is
+# what moving a function from ROM to IWRAM saves
+#
+# usage: arm-none-eabi-nm -S -n program.elf | awk -f tools/mapreport.awk
+
+# awk has no hex, so do it by hand
+function hex(text,    i, n) {
+	n = 0
+	text = tolower(text)
+	for (i = 1; i <= length(text); i++) {
+		n = n * 16 + index("0123456789abcdef", substr(text, i, 1)) - 1
+	}
+	return n
+}
+
+BEGIN {
+	printf "%-28s %-6s %-5s %6s %7s\n", "symbol", "where", "code", "bytes", "cycles"
+}
+
+# only symbols with a size, which are the functions and variables
+NF == 4 {
+	address = hex($1)
+	size = hex($2)
+	type = toupper($3)
+	area = substr($1, length($1) - 7, 2)
+	where = area == "08" ? "rom" : area == "03" ? "iwram" : area == "02" ? "ewram" : "other"
+	totals[where] += size
+
+	if (type != "T") {
+		printf "%-28s %-6s %-5s %6d\n", $4, where, "data", size
+		next
+	}
+
+	# thumb functions have the bottom bit of their address set
+	thumb = address % 2
+	code = thumb ? "thumb" : "arm"
+
+	# with the wait states main sets, ROM takes 2 cycles for each sequential
+	# 16 bit fetch, so 4 for an ARM instruction; EWRAM takes 3 a halfword;
+	# IWRAM fetches 32 bits in 1
+	if (where == "iwram") {
+		cycles = size / 4
+	} else if (where == "ewram") {
+		cycles = size / 2 * 3
+	} else {
+		cycles = size / 2 * 2
+	}
+	fetch[where] += cycles
+	printf "%-28s %-6s %-5s %6d %7d\n", $4, where, code, size, cycles
+}
+
+END {
+	printf "\n"
+	for (where in totals) {
+		printf "%-6s %6d bytes of symbols, %d cycles to fetch its functions once\n", where, totals[where], fetch[where]
+	}
+}
@@ -0,0 +1,578 @@
+/*
+ * mkassets.c
+ * turns the background image, sprite sheet and tile maps into the headers
+ * collide.c includes: background.h, spritesheet.h and map.h, map2.h ...
+ *
+ * background tiles which are the same as another tile, or a flipped copy of
+ * one, are only stored once and the maps use the flip bits instead
+ *
+ * each map also gets a collision layer, 2 bits for each of its tiles, from
+ * lists of which background tiles are solid, one way platforms or hazards
+ *
+ * the tiles of each image and the entries of each map are also written out
+ * on their own, as background.bin, map2.bin ..., for tools/gbapack to pack -
+ * the arrays in the headers are static, so the ones the game loads packed
+ * instead don't take up room in the ROM
+ *
+ * build: gcc -O2 mkassets.c -o mkassets
+ * usage: mkassets [-o dir] -b background.ppm -s spritesheet.ppm
+ *                 [-S solid] [-P platforms] [-H hazards] map.csv map2.csv ...
+ *
+ * the tile lists are ranges of tile numbers like 1-6,12-17
+ *
+ * images are binary PPMs, and the color of the top left pixel of each is
+ * the transparent one, color 0 - maps are comma separated tile numbers, which
+ * count the 8x8 tiles of the background image left to right, top to bottom
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* the flip bits of a screen block entry */
+#define MAP_HFLIP 0x400
+#define MAP_VFLIP 0x800
+
+/* the kinds of tile in a collision layer, these match collide.c */
+#define TILE_EMPTY 0
+#define TILE_SOLID 1
+#define TILE_ONE_WAY 2
+#define TILE_HAZARD 3
+
+/* the background only gets the first 15 palette banks, the last one is the
+ * HUD's, which has 16 color text over the 256 color background */
+#define BACKGROUND_COLORS 240
+
+/* an image in 15 bit GBA colors */
+struct Image {
+	int width, height;
+	unsigned short* pixels;
+};
+
+/* a 256 color image cut into 8x8 tiles of 64 bytes each */
+struct Tiles {
+	int count;
+	unsigned char* data;
+};
+
+/* read a binary PPM, returns 0 on failure */
+static int read_ppm(const char* filename, struct Image* image) {
+	FILE* file = fopen(filename, "rb");
+	if (!file) {
+		perror(filename);
+		return 0;
+	}
+
+	int maxval;
+	if (fscanf(file, "P6 %d %d %d", &image->width, &image->height, &maxval) != 3 || maxval != 255) {
+		fprintf(stderr, "%s: only binary PPM with 8 bit channels is supported\n", filename);
+		fclose(file);
+		return 0;
+	}
+	fgetc(file);
+
+	if (image->width % 8 || image->height % 8) {
+		fprintf(stderr, "%s: width and height must be multiples of 8\n", filename);
+		fclose(file);
+		return 0;
+	}
+
+	int count = image->width * image->height;
+	image->pixels = malloc(count * sizeof(unsigned short));
+	for (int i = 0; i < count; i++) {
+		int r = fgetc(file), g = fgetc(file), b = fgetc(file);
+		if (b == EOF) {
+			fprintf(stderr, "%s: image is cut short\n", filename);
+			fclose(file);
+			return 0;
+		}
+		image->pixels[i] = (r >> 3) | ((g >> 3) << 5) | ((b >> 3) << 10);
+	}
+
+	fclose(file);
+	return 1;
+}
+
+/* a box of colors for median cut */
+struct Box {
+	int first, count;
+};
+
+static int channel(unsigned short color, int c) {
+	return (color >> (c * 5)) & 31;
+}
+
+/* colors sorted on one channel for median cut */
+static int sort_channel;
+static int compare_colors(const void* a, const void* b) {
+	return channel(*(const unsigned short*) a, sort_channel) - channel(*(const unsigned short*) b, sort_channel);
+}
+
+/* build a palette of at most max_colors for the images given, with the
+ * transparent color at 0, and fill in lookup with the palette index for every
+ * 15 bit color they use - returns how many colors the images had */
+static int quantize(struct Image* images, int image_count, int max_colors, unsigned short* palette, unsigned char* lookup) {
+	unsigned int* counts = calloc(32768, sizeof(unsigned int));
+	unsigned short transparent = images[0].pixels[0];
+
+	for (int i = 0; i < image_count; i++) {
+		for (int p = 0; p < images[i].width * images[i].height; p++) {
+			counts[images[i].pixels[p]]++;
+		}
+	}
+	counts[transparent] = 0;
+
+	unsigned short* colors = malloc(32768 * sizeof(unsigned short));
+	int unique = 0;
+	for (int c = 0; c < 32768; c++) {
+		if (counts[c]) {
+			colors[unique++] = c;
+		}
+	}
+
+	/* split the box with the widest spread of any channel in half, by pixel
+	 * count, until there is a box for each color or nothing left to split */
+	struct Box boxes[255];
+	int box_count = 1;
+	boxes[0] = (struct Box) {0, unique};
+
+	while (box_count < max_colors - 1) {
+		int widest = -1, widest_channel = 0, widest_range = 0;
+		for (int b = 0; b < box_count; b++) {
+			if (boxes[b].count < 2) {
+				continue;
+			}
+			for (int c = 0; c < 3; c++) {
+				int low = 31, high = 0;
+				for (int i = boxes[b].first; i < boxes[b].first + boxes[b].count; i++) {
+					int v = channel(colors[i], c);
+					low = v < low ? v : low;
+					high = v > high ? v : high;
+				}
+				if (high - low > widest_range) {
+					widest = b;
+					widest_channel = c;
+					widest_range = high - low;
+				}
+			}
+		}
+		if (widest < 0) {
+			break;
+		}
+
+		struct Box* box = &boxes[widest];
+		sort_channel = widest_channel;
+		qsort(colors + box->first, box->count, sizeof(unsigned short), compare_colors);
+
+		unsigned long total = 0, half = 0;
+		for (int i = box->first; i < box->first + box->count; i++) {
+			total += counts[colors[i]];
+		}
+		int split = box->first + 1;
+		for (int i = box->first; i < box->first + box->count - 1; i++) {
+			half += counts[colors[i]];
+			split = i + 1;
+			if (half * 2 >= total) {
+				break;
+			}
+		}
+
+		boxes[box_count++] = (struct Box) {split, box->first + box->count - split};
+		box->count = split - box->first;
+	}
+
+	/* each box becomes the pixel weighted average of its colors */
+	palette[0] = transparent;
+	for (int b = 0; b < box_count; b++) {
+		unsigned long sum[3] = {0, 0, 0}, weight = 0;
+		for (int i = boxes[b].first; i < boxes[b].first + boxes[b].count; i++) {
+			for (int c = 0; c < 3; c++) {
+				sum[c] += channel(colors[i], c) * (unsigned long) counts[colors[i]];
+			}
+			weight += counts[colors[i]];
+		}
+		palette[b + 1] = 0;
+		for (int c = 0; c < 3; c++) {
+			palette[b + 1] |= ((sum[c] + weight / 2) / (weight ? weight : 1)) << (c * 5);
+		}
+		for (int i = boxes[b].first; i < boxes[b].first + boxes[b].count; i++) {
+			lookup[colors[i]] = b + 1;
+		}
+	}
+	for (int b = box_count + 1; b < 256; b++) {
+		palette[b] = 0;
+	}
+	lookup[transparent] = 0;
+
+	free(colors);
+	free(counts);
+	return unique + 1;
+}
+
+/* cut an image into 8x8 tiles, left to right and top to bottom */
+static void cut_tiles(const struct Image* image, const unsigned char* lookup, struct Tiles* tiles) {
+	int across = image->width / 8, down = image->height / 8;
+	tiles->count = across * down;
+	tiles->data = malloc(tiles->count * 64);
+
+	for (int t = 0; t < tiles->count; t++) {
+		for (int y = 0; y < 8; y++) {
+			for (int x = 0; x < 8; x++) {
+				int px = (t % across) * 8 + x, py = (t / across) * 8 + y;
+				tiles->data[t * 64 + y * 8 + x] = lookup[image->pixels[py * image->width + px]];
+			}
+		}
+	}
+}
+
+/* flip a tile into out */
+static void flip_tile(const unsigned char* tile, int flip, unsigned char* out) {
+	for (int y = 0; y < 8; y++) {
+		for (int x = 0; x < 8; x++) {
+			int sx = (flip & MAP_HFLIP) ? 7 - x : x;
+			int sy = (flip & MAP_VFLIP) ? 7 - y : y;
+			out[y * 8 + x] = tile[sy * 8 + sx];
+		}
+	}
+}
+
+static unsigned int hash_tile(const unsigned char* tile) {
+	unsigned int hash = 2166136261u;
+	for (int i = 0; i < 64; i++) {
+		hash = (hash ^ tile[i]) * 16777619u;
+	}
+	return hash;
+}
+
+/* an entry in the table of tiles seen so far, in each of their flips */
+struct Seen {
+	int used;
+	unsigned int hash;
+	int tile;
+	int flip;
+};
+
+/* store each tile once, giving the map entry (tile number and flip bits) for
+ * every original tile - unique tiles are numbered in the order they first
+ * appear, so a tile keeps its number unless one before it was a repeat */
+static void dedup_tiles(const struct Tiles* in, struct Tiles* out, unsigned short* entries) {
+	int slots = 1;
+	while (slots < in->count * 8) {
+		slots <<= 1;
+	}
+	struct Seen* seen = calloc(slots, sizeof(struct Seen));
+	out->data = malloc(in->count * 64);
+	out->count = 0;
+
+	for (int t = 0; t < in->count; t++) {
+		const unsigned char* tile = in->data + t * 64;
+		unsigned int hash = hash_tile(tile);
+
+		/* look for it, as it is or as a flip of a tile we have */
+		int found = -1;
+		for (int s = hash & (slots - 1); seen[s].used; s = (s + 1) & (slots - 1)) {
+			if (seen[s].hash == hash) {
+				unsigned char flipped[64];
+				flip_tile(out->data + seen[s].tile * 64, seen[s].flip, flipped);
+				if (memcmp(flipped, tile, 64) == 0) {
+					found = s;
+					break;
+				}
+			}
+		}
+		if (found >= 0) {
+			entries[t] = seen[found].tile | seen[found].flip;
+			continue;
+		}
+
+		/* a new tile - remember all four ways round it can be used */
+		int index = out->count++;
+		memcpy(out->data + index * 64, tile, 64);
+		entries[t] = index;
+		for (int flip = 0; flip <= (MAP_HFLIP | MAP_VFLIP); flip += MAP_HFLIP) {
+			unsigned char flipped[64];
+			flip_tile(tile, flip, flipped);
+			unsigned int h = hash_tile(flipped);
+			int s = h & (slots - 1);
+			while (seen[s].used) {
+				s = (s + 1) & (slots - 1);
+			}
+			seen[s] = (struct Seen) {1, h, index, flip};
+		}
+	}
+
+	free(seen);
+}
+
+/* the file name without its directory or extension, which names the arrays */
+static void base_name(const char* path, char* name) {
+	const char* slash = strrchr(path, '/');
+	strcpy(name, slash ? slash + 1 : path);
+	char* dot = strrchr(name, '.');
+	if (dot) {
+		*dot = '\0';
+	}
+}
+
+static FILE* open_header(const char* dir, const char* name, const char* source) {
+	char path[1024];
+	snprintf(path, sizeof(path), "%s/%s.h", dir, name);
+	FILE* file = fopen(path, "w");
+	if (!file) {
+		perror(path);
+		exit(1);
+	}
+	fprintf(file, "/* generated by mkassets from %s */\n\n", source);
+	return file;
+}
+
+/* write the bytes of an image or map just as they go into VRAM */
+static void write_binary(const char* dir, const char* name, const void* data, int bytes) {
+	char path[1024];
+	snprintf(path, sizeof(path), "%s/%s.bin", dir, name);
+	FILE* file = fopen(path, "wb");
+	if (!file || fwrite(data, 1, bytes, file) != (size_t) bytes) {
+		perror(path);
+		exit(1);
+	}
+	fclose(file);
+}
+
+/* write an image's palette and tiles the way setup_background and
+ * setup_sprite_image expect them */
+static void write_image(const char* dir, const char* name, const char* source,
+		const unsigned short* palette, const struct Tiles* tiles) {
+	FILE* file = open_header(dir, name, source);
+
+	/* the tiles are written as a column 8 pixels wide */
+	fprintf(file, "#define %s_width 8\n", name);
+	fprintf(file, "#define %s_height %d\n\n", name, tiles->count * 8);
+
+	fprintf(file, "const unsigned short %s_palette[256] __attribute__((aligned(4))) = {", name);
+	for (int i = 0; i < 256; i++) {
+		fprintf(file, "%s0x%04x,", (i % 8) ? " " : "\n\t", palette[i]);
+	}
+	fprintf(file, "\n};\n\n");
+
+	fprintf(file, "static const unsigned char %s_data[%d] __attribute__((aligned(4))) = {", name, tiles->count * 64);
+	for (int i = 0; i < tiles->count * 64; i++) {
+		fprintf(file, "%s0x%02x,", (i % 16) ? " " : "\n\t", tiles->data[i]);
+	}
+	fprintf(file, "\n};\n");
+	fclose(file);
+
+	write_binary(dir, name, tiles->data, tiles->count * 64);
+}
+
+/* mark the tiles in a list of ranges like 1-6,12-17 as one kind */
+static int parse_ranges(const char* list, int kind, unsigned char* kinds, int tile_count) {
+	const char* p = list;
+	while (*p) {
+		char* end;
+		long first = strtol(p, &end, 10), last = first;
+		if (end == p) {
+			fprintf(stderr, "bad tile list: %s\n", list);
+			return 0;
+		}
+		p = end;
+		if (*p == '-') {
+			last = strtol(p + 1, &end, 10);
+			p = end;
+		}
+		for (long t = first; t <= last && t < tile_count; t++) {
+			if (t >= 0) {
+				kinds[t] = kind;
+			}
+		}
+		if (*p == ',') {
+			p++;
+		}
+	}
+	return 1;
+}
+
+/* the power of two a number is, or -1 if it isn't one */
+static int log2_exact(int n) {
+	for (int shift = 0; shift < 16; shift++) {
+		if (n == (1 << shift)) {
+			return shift;
+		}
+	}
+	return -1;
+}
+
+/* read a map and write it out using the deduplicated tiles, along with its
+ * collision layer */
+static int convert_map(const char* dir, const char* path, const unsigned short* entries,
+		const unsigned char* tile_kinds, int tile_count) {
+	FILE* in = fopen(path, "r");
+	if (!in) {
+		perror(path);
+		return 0;
+	}
+
+	int capacity = 1024, count = 0, width = 0, height = 0, row = 0;
+	unsigned short* map = malloc(capacity * sizeof(unsigned short));
+	unsigned char* kinds = malloc(capacity);
+	char line[65536];
+	while (fgets(line, sizeof(line), in)) {
+		int columns = 0;
+		for (char* cell = strtok(line, ",\r\n"); cell; cell = strtok(NULL, ",\r\n")) {
+			int tile = atoi(cell);
+			if (tile < 0 || tile >= tile_count) {
+				fprintf(stderr, "%s: tile %d is not in the background image, using 0\n", path, tile);
+				tile = 0;
+			}
+			if (count == capacity) {
+				capacity *= 2;
+				map = realloc(map, capacity * sizeof(unsigned short));
+				kinds = realloc(kinds, capacity);
+			}
+			kinds[count] = tile_kinds[tile];
+			map[count++] = entries[tile];
+			columns++;
+		}
+		if (columns == 0) {
+			continue;
+		}
+		if (row == 0) {
+			width = columns;
+		} else if (columns != width) {
+			fprintf(stderr, "%s: row %d has %d tiles, not %d\n", path, row + 1, columns, width);
+			fclose(in);
+			return 0;
+		}
+		row++;
+	}
+	height = row;
+	fclose(in);
+
+	/* the game finds rows of the collision layer by masking, so the height
+	 * has to be a power of two - levels can be any width */
+	int height_shift = log2_exact(height);
+	if (height_shift < 0) {
+		fprintf(stderr, "%s: the map is %d tiles high, but that must be a power of two\n", path, height);
+		return 0;
+	}
+
+	char name[256];
+	base_name(path, name);
+	FILE* file = open_header(dir, name, path);
+	fprintf(file, "#define %s_width %d\n", name, width);
+	fprintf(file, "#define %s_height %d\n\n", name, height);
+	fprintf(file, "static const unsigned short %s[%d] __attribute__((aligned(4))) = {", name, count);
+	for (int i = 0; i < count; i++) {
+		fprintf(file, "%s0x%04x,", (i % width) ? " " : "\n\t", map[i]);
+	}
+	fprintf(file, "\n};\n\n");
+
+	/* the collision layer: 2 bits a tile, 16 tiles to a word, low bits first */
+	int words = (count + 15) / 16;
+	fprintf(file, "/* collision layer: 0 empty, 1 solid, 2 one way platform, 3 hazard */\n");
+	fprintf(file, "#define %s_collision_width %d\n", name, width);
+	fprintf(file, "#define %s_collision_height_shift %d\n\n", name, height_shift);
+	fprintf(file, "const unsigned int %s_collision[%d] __attribute__((aligned(4))) = {", name, words);
+	for (int w = 0; w < words; w++) {
+		unsigned int bits = 0;
+		for (int i = 0; i < 16 && w * 16 + i < count; i++) {
+			bits |= (unsigned int) kinds[w * 16 + i] << (i * 2);
+		}
+		fprintf(file, "%s0x%08x,", (w % 8) ? " " : "\n\t", bits);
+	}
+	fprintf(file, "\n};\n");
+	fclose(file);
+
+	/* the entries little endian, the way the GBA has them */
+	unsigned char* bytes = malloc(count * 2);
+	for (int i = 0; i < count; i++) {
+		bytes[i * 2] = map[i] & 0xff;
+		bytes[i * 2 + 1] = map[i] >> 8;
+	}
+	write_binary(dir, name, bytes, count * 2);
+	free(bytes);
+
+	free(map);
+	free(kinds);
+	return 1;
+}
+
+int main(int argc, char** argv) {
+	const char* dir = ".";
+	const char* background_path = NULL;
+	const char* sprites_path = NULL;
+	const char* lists[4] = {NULL, NULL, NULL, NULL};
+
+	int option;
+	while ((option = getopt(argc, argv, "o:b:s:S:P:H:")) != -1) {
+		switch (option) {
+			case 'o': dir = optarg; break;
+			case 'b': background_path = optarg; break;
+			case 's': sprites_path = optarg; break;
+			case 'S': lists[TILE_SOLID] = optarg; break;
+			case 'P': lists[TILE_ONE_WAY] = optarg; break;
+			case 'H': lists[TILE_HAZARD] = optarg; break;
+			default: background_path = NULL; break;
+		}
+	}
+	if (!background_path) {
+		fprintf(stderr, "usage: %s [-o dir] -b background.ppm [-s spritesheet.ppm] "
+				"[-S solid] [-P platforms] [-H hazards] map.csv ...\n", argv[0]);
+		return 1;
+	}
+
+	char name[256];
+	unsigned short palette[256];
+	unsigned char* lookup = malloc(32768);
+
+	/* the background: quantize, cut into tiles, and keep one of each */
+	struct Image background;
+	if (!read_ppm(background_path, &background)) {
+		return 1;
+	}
+	int colors = quantize(&background, 1, BACKGROUND_COLORS, palette, lookup);
+
+	struct Tiles tiles, unique;
+	cut_tiles(&background, lookup, &tiles);
+	unsigned short* entries = malloc(tiles.count * sizeof(unsigned short));
+	dedup_tiles(&tiles, &unique, entries);
+
+	base_name(background_path, name);
+	write_image(dir, name, background_path, palette, &unique);
+	printf("%s: %d colors, %d tiles -> %d tiles (%d bytes saved)\n", name,
+			colors > BACKGROUND_COLORS ? BACKGROUND_COLORS : colors,
+			tiles.count, unique.count, (tiles.count - unique.count) * 64);
+
+	/* the sprite sheet keeps every tile in order, since the frames of a
+	 * sprite have to follow each other in 1D mapping */
+	if (sprites_path) {
+		struct Image sprites;
+		if (!read_ppm(sprites_path, &sprites)) {
+			return 1;
+		}
+		colors = quantize(&sprites, 1, 256, palette, lookup);
+
+		struct Tiles sprite_tiles;
+		cut_tiles(&sprites, lookup, &sprite_tiles);
+		base_name(sprites_path, name);
+		write_image(dir, name, sprites_path, palette, &sprite_tiles);
+		printf("%s: %d colors, %d tiles\n", name, colors > 256 ? 256 : colors, sprite_tiles.count);
+	}
+
+	/* which kind of tile each of the original background tiles is */
+	unsigned char* tile_kinds = calloc(tiles.count, 1);
+	for (int kind = TILE_SOLID; kind <= TILE_HAZARD; kind++) {
+		if (lists[kind] && !parse_ranges(lists[kind], kind, tile_kinds, tiles.count)) {
+			return 1;
+		}
+	}
+
+	/* and the maps, which refer to the tiles of the background */
+	for (int i = optind; i < argc; i++) {
+		if (!convert_map(dir, argv[i], entries, tile_kinds, tiles.count)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}